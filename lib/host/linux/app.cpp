@@ -103,5 +103,10 @@ namespace cycfi { namespace elements
    {
       g_application_release(G_APPLICATION(_app));
    }
+
+   fs::path app_data_path()
+   {
+      return fs::path{ g_get_user_data_dir() };
+   }
 }}
 
@@ -4,6 +4,7 @@
    Distributed under the MIT License (https://opensource.org/licenses/MIT)
 =============================================================================*/
 #include <elements/app.hpp>
+#include <elements/support/resource_paths.hpp>
 #import <Cocoa/Cocoa.h>
 
 namespace cycfi { namespace elements
@@ -50,5 +51,12 @@ namespace cycfi { namespace elements
    {
       [NSApp terminate : nil];
    }
+
+   fs::path app_data_path()
+   {
+      NSArray* paths = NSSearchPathForDirectoriesInDomains(
+         NSApplicationSupportDirectory, NSUserDomainMask, YES);
+      return fs::path{ [[paths firstObject] UTF8String] };
+   }
 }}
 
@@ -10,8 +10,11 @@
 #include <elements/element/button.hpp>
 #include <elements/element/composite.hpp>
 #include <elements/element/child_window.hpp>
+#include <elements/element/code_text.hpp>
 #include <elements/element/dial.hpp>
 #include <elements/element/dynamic_list.hpp>
+#include <elements/element/dynamic_table.hpp>
+#include <elements/element/dynamic_tree.hpp>
 #include <elements/element/floating.hpp>
 #include <elements/element/flow.hpp>
 #include <elements/element/grid.hpp>
@@ -19,6 +22,7 @@
 #include <elements/element/indirect.hpp>
 #include <elements/element/label.hpp>
 #include <elements/element/layer.hpp>
+#include <elements/element/log_view.hpp>
 #include <elements/element/margin.hpp>
 #include <elements/element/menu.hpp>
 #include <elements/element/misc.hpp>
@@ -31,6 +35,7 @@
 #include <elements/element/text.hpp>
 #include <elements/element/thumbwheel.hpp>
 #include <elements/element/tile.hpp>
+#include <elements/element/tiled_image.hpp>
 #include <elements/element/tooltip.hpp>
 
 // Include this last
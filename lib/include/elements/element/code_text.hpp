@@ -0,0 +1,153 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_CODE_TEXT_OCTOBER_19_2026)
+#define ELEMENTS_CODE_TEXT_OCTOBER_19_2026
+
+#include <elements/element/text.hpp>
+#include <infra/string_view.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // Text styles and style spans
+   ////////////////////////////////////////////////////////////////////////////
+   struct text_style
+   {
+      color                   color_;
+      bool                    bold = false;
+      bool                    underline = false;
+   };
+
+   // A run of bytes [first, last) of a line, drawn with the text_style at
+   // index style of the code_text_box's style table.
+   struct style_span
+   {
+      std::uint32_t           first;
+      std::uint32_t           last;
+      std::uint16_t           style;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tokenizer: Lexes text one line at a time. tokenize is given a line
+   // (excluding the newline) and the state at its start (0 for the first
+   // line), appends the line's style spans (sorted and non-overlapping)
+   // and returns the state at its end. The state carries whatever spans
+   // lines, such as an open block comment.
+   ////////////////////////////////////////////////////////////////////////////
+   class tokenizer
+   {
+   public:
+
+      using state_type = std::uint32_t;
+
+      virtual                 ~tokenizer() = default;
+      virtual state_type      tokenize(
+                                 string_view line
+                               , state_type state
+                               , std::vector<style_span>& spans
+                              ) const = 0;
+   };
+
+   using tokenizer_ptr = std::shared_ptr<tokenizer const>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // c_like_tokenizer: Keywords, numbers, string and character literals,
+   // and // and /* */ comments.
+   ////////////////////////////////////////////////////////////////////////////
+   class c_like_tokenizer : public tokenizer
+   {
+   public:
+
+      enum style_id : std::uint16_t
+      {
+         plain_style
+       , keyword_style
+       , comment_style
+       , string_style
+       , number_style
+      };
+
+                              c_like_tokenizer(std::vector<std::string> keywords);
+                              c_like_tokenizer(c_like_tokenizer const& rhs);
+      c_like_tokenizer&       operator=(c_like_tokenizer const& rhs);
+
+      state_type              tokenize(
+                                 string_view line
+                               , state_type state
+                               , std::vector<style_span>& spans
+                              ) const override;
+
+   private:
+
+      std::vector<std::string> _keyword_list;
+      std::unordered_set<string_view> _keywords;   // Views of _keyword_list
+   };
+
+   // Styles for the c_like_tokenizer style_ids
+   std::vector<text_style> default_code_styles();
+
+   ////////////////////////////////////////////////////////////////////////////
+   // code_text_box: An editable text box that draws attributed runs (color,
+   // weight, underline) given by a tokenizer. The tokenizer's output is
+   // cached per line, along with the states at the start and end of the
+   // line. Only lines an edit touches are re-lexed, and the lines after
+   // them only as long as their incoming states differ. Lexing is lazy: it
+   // goes only as far as the last line drawn.
+   //
+   // The text is shaped once with the box's font. Bold is drawn as faux
+   // bold so that advances, wrapping and caret positions are unaffected
+   // by the styles.
+   ////////////////////////////////////////////////////////////////////////////
+   class code_text_box : public basic_text_box
+   {
+   public:
+                              code_text_box(
+                                 std::string text
+                               , tokenizer_ptr tokenizer_
+                               , std::vector<text_style> styles = default_code_styles()
+                               , font font_        = get_theme().text_box_font
+                               , float size        = get_theme().text_box_font_size
+                              );
+                              code_text_box(code_text_box&& rhs) = default;
+
+      void                    draw(context const& ctx) override;
+
+      std::vector<text_style> const& styles() const   { return _styles; }
+      void                    styles(std::vector<text_style> styles_);
+      tokenizer_ptr const&    get_tokenizer() const   { return _tokenizer; }
+      void                    set_tokenizer(tokenizer_ptr tokenizer_);
+
+   private:
+
+      struct line_info
+      {
+         text_buffer::line_ptr   text;
+         tokenizer::state_type   in = 0;
+         tokenizer::state_type   out = 0;
+         std::vector<style_span> spans;
+         bool                    lexed = false;
+      };
+
+      void                    sync_lines();
+      void                    lex_through(std::size_t line);
+      void                    draw_row(
+                                 context const& ctx, point pos
+                               , glyphs& row, line_info const& info
+                              );
+
+      tokenizer_ptr           _tokenizer;
+      std::vector<text_style> _styles;
+      std::vector<line_info>  _lines;
+      std::size_t             _lexed = 0;          // Lines lexed and valid from the top
+   };
+}}
+
+#endif
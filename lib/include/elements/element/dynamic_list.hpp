@@ -7,6 +7,7 @@
 #define ELEMENTS_DYNAMIC_MARCH_2_2020
 
 #include <elements/element/element.hpp>
+#include <elements/support/detail/fenwick_tree.hpp>
 #include <memory>
 #include <vector>
 #include <functional>
@@ -30,6 +31,31 @@ namespace cycfi { namespace elements
       virtual element_ptr     compose(std::size_t index) = 0;
       virtual limits          width_limits(basic_context const& ctx) const = 0;
       virtual float           line_height(std::size_t index, basic_context const& ctx) const = 0;
+
+                              // Optional cell reuse protocol. The cells of a
+                              // composer that recycles are kept in a small
+                              // pool when their rows scroll out of view, and
+                              // are rebound to rows scrolling into view
+                              // instead of composing new ones. rebind returns
+                              // false, leaving the cell as it is, if the cell
+                              // can't show the row (e.g. it is of a different
+                              // kind). Such cells stay in the pool.
+      virtual bool            recycles() const { return false; }
+      virtual bool            rebind(element& /*cell*/, std::size_t /*index*/) { return false; }
+
+                              // Optional asynchronous protocol. Rows that are
+                              // not ready (their data is still being fetched)
+                              // are drawn as placeholder cells. The list calls
+                              // request with the rows it wants (those in view
+                              // and some ahead of them) and a function that
+                              // the composer calls, from any thread, when some
+                              // of them are ready. line_height must not depend
+                              // on data that is not ready.
+      using ready_function = std::function<void(std::size_t first, std::size_t last)>;
+
+      virtual bool            is_ready(std::size_t /*index*/) const { return true; }
+      virtual void            request(std::size_t /*first*/, std::size_t /*last*/, ready_function const& /*ready*/) {}
+      virtual element_ptr     placeholder(std::size_t index);
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -137,6 +163,85 @@ namespace cycfi { namespace elements
       F                       _compose;
    };
 
+   ////////////////////////////////////////////////////////////////////////////
+   // This cell composer recycles cell elements using a provided function.
+   // The function is given a cell element (composed earlier) and the index
+   // of the row it should show.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F, typename Base = cell_composer>
+   class function_rebind_cell_composer : public Base
+   {
+   public:
+
+                              template <typename... Rest>
+                              function_rebind_cell_composer(F&& rebind_, Rest&& ...rest)
+                               : Base(std::forward<Rest>(rest)...)
+                               , _rebind(rebind_)
+                              {}
+
+      bool                    recycles() const override { return true; }
+      bool                    rebind(element& cell, std::size_t index) override { return _rebind(cell, index); }
+
+   private:
+
+      F                       _rebind;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // paged_cell_composer: An abstract cell composer for data that is fetched
+   // asynchronously, a page of rows at a time, e.g. from a database or a
+   // large file. load_page is called on a worker thread to fetch rows
+   // [first, last) into a page (whatever the derived class wants to keep
+   // for them). compose_row (and rebind_row) are called on the UI thread,
+   // and only for rows whose page has arrived. At most max_pages pages are
+   // kept, the least recently used pages that are out of view are dropped.
+   // Requests for pages that scroll out of view before they are loaded are
+   // skipped. Call invalidate after the data changes, and then the list's
+   // update, so that rows already composed from the old pages are composed
+   // again.
+   //
+   // The composer must be held by a shared_ptr (see dynamic_list).
+   ////////////////////////////////////////////////////////////////////////////
+   class paged_cell_composer : public cell_composer
+   {
+   public:
+
+      struct page
+      {
+         virtual              ~page() = default;
+      };
+
+      using page_ptr = std::shared_ptr<page const>;
+
+                              paged_cell_composer(
+                                 std::size_t page_size = 128
+                               , std::size_t max_pages = 32
+                              );
+                              ~paged_cell_composer();
+
+      element_ptr             compose(std::size_t index) override;
+      bool                    rebind(element& cell, std::size_t index) override;
+      bool                    is_ready(std::size_t index) const override;
+      void                    request(std::size_t first, std::size_t last, ready_function const& ready) override;
+
+      void                    invalidate();
+
+   protected:
+
+      virtual page_ptr        load_page(std::size_t first, std::size_t last) const = 0;
+      virtual element_ptr     compose_row(std::size_t index, page const& page_, std::size_t offset) = 0;
+      virtual bool            rebind_row(element& cell, std::size_t index, page const& page_, std::size_t offset);
+
+   private:
+
+      struct page_cache;
+
+      page_ptr                find_page(std::size_t index) const;
+
+      std::size_t             _page_size;
+      std::unique_ptr<page_cache> _cache;
+   };
+
    ////////////////////////////////////////////////////////////////////////////
    // basic_cell_composer given the number of elements and a compose function
    ////////////////////////////////////////////////////////////////////////////
@@ -153,6 +258,32 @@ namespace cycfi { namespace elements
       return share(return_type{ size, std::forward<ftype>(compose) });
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   // basic_cell_composer given the number of elements, a compose function
+   // and a rebind function (see function_rebind_cell_composer).
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F, typename G>
+   inline auto basic_cell_composer(std::size_t size, F&& compose, G&& rebind)
+   {
+      using ftype = remove_cvref_t<F>;
+      using gtype = remove_cvref_t<G>;
+      using return_type =
+         fixed_derived_limits_cell_composer<
+            fixed_length_cell_composer<
+               function_cell_composer<ftype,
+                  function_rebind_cell_composer<gtype>
+               >
+            >
+         >;
+      return share(
+         return_type{
+            size
+          , std::forward<ftype>(compose)
+          , std::forward<gtype>(rebind)
+         }
+      );
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // basic_cell_composer given the min_width, line_height, number of
    // elements and a compose function.
@@ -217,7 +348,9 @@ namespace cycfi { namespace elements
 
                                  dynamic_list(composer_ptr composer)
                                   : _composer(composer)
-                                 {}
+                                 {
+                                    _pool.reserve(_pool_size);
+                                 }
 
       view_limits                limits(basic_context const& ctx) const override;
       void                       draw(context const& ctx) override;
@@ -226,17 +359,45 @@ namespace cycfi { namespace elements
       void                       update();
       void                       update(basic_context const& ctx) const;
 
+                                 // Incremental updates. Call these after making
+                                 // the same change to the composer's data.
+                                 // Only the rows inserted (or resized) are
+                                 // measured, and the cells composed for the
+                                 // other rows are kept. recompose drops the
+                                 // cell of a row whose content changed.
+      void                       insert(std::size_t index, std::size_t count = 1);
+      void                       erase(std::size_t index, std::size_t count = 1);
+      void                       move(std::size_t from, std::size_t to);
+      void                       resize_row(std::size_t index);
+      void                       recompose(std::size_t index);
+
+                                 // The maximum number of offscreen cells kept
+                                 // for reuse, if the composer recycles.
+      std::size_t                pool_size() const          { return _pool_size; }
+      void                       pool_size(std::size_t n);
+
+   protected:
+
+                                 // The index of the row at pos (relative to
+                                 // the top of the list), or the number of rows
+                                 // if there is none.
+      std::size_t                row_at(double pos) const;
+
    private:
 
+      element_ptr                compose(std::size_t index);
+      void                       release(std::size_t index);
+      void                       request(context const& ctx, std::size_t first, std::size_t last);
+
       struct row_info
       {
-         double                  pos;
-         double                  height;
          element_ptr             elem_ptr;
          int                     layout_id = -1;
+         bool                    placeholder = false;
       };
 
       using rows_vector = std::vector<row_info>;
+      using heights_tree = detail::fenwick_tree;
 
       composer_ptr               _composer;
       point                      _previous_size;
@@ -244,7 +405,13 @@ namespace cycfi { namespace elements
       std::size_t                _previous_window_end = 0;
 
       mutable rows_vector        _rows;
-      mutable double             _height = 0;
+      mutable heights_tree       _heights;          // Row heights and positions
+      mutable std::vector<std::size_t> _pending;    // Rows yet to be measured
+      std::vector<element_ptr>   _pool;             // Offscreen cells for reuse
+      std::size_t                _pool_size = 16;
+      cell_composer::ready_function _ready;
+      view*                      _ready_view = nullptr;
+      bool                       _placeholders = false;  // Placeholder rows were drawn
       mutable int                _layout_id = 0;
       mutable bool               _update_request = true;
    };
@@ -0,0 +1,171 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DYNAMIC_TABLE_OCTOBER_19_2026)
+#define ELEMENTS_DYNAMIC_TABLE_OCTOBER_19_2026
+
+#include <elements/element/element.hpp>
+#include <elements/support/detail/fenwick_tree.hpp>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The table composer abstract class
+   ////////////////////////////////////////////////////////////////////////////
+   class table_composer : public std::enable_shared_from_this<table_composer>
+   {
+   public:
+
+      virtual std::size_t     num_rows() const = 0;
+      virtual std::size_t     num_cols() const = 0;
+      virtual float           row_height(std::size_t row, basic_context const& ctx) const = 0;
+      virtual float           col_width(std::size_t col, basic_context const& ctx) const = 0;
+      virtual element_ptr     compose(std::size_t row, std::size_t col) = 0;
+
+                              // The number of leading rows and columns that
+                              // stay in view when scrolled (sticky headers).
+      virtual std::size_t     header_rows() const { return 0; }
+      virtual std::size_t     header_cols() const { return 0; }
+
+                              // Optional cell reuse protocol. See
+                              // cell_composer::recycles and rebind.
+      virtual bool            recycles() const { return false; }
+      virtual bool            rebind(element& /*cell*/, std::size_t /*row*/, std::size_t /*col*/) { return false; }
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // This table composer has uniform row heights and column widths, and
+   // composes the cell elements using a provided function.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F>
+   class uniform_table_composer : public table_composer
+   {
+   public:
+
+                              uniform_table_composer(
+                                 std::size_t num_rows, std::size_t num_cols
+                               , float col_width, float row_height
+                               , F&& compose_
+                               , std::size_t header_rows = 0
+                               , std::size_t header_cols = 0
+                              )
+                               : _num_rows(num_rows)
+                               , _num_cols(num_cols)
+                               , _col_width(col_width)
+                               , _row_height(row_height)
+                               , _header_rows(header_rows)
+                               , _header_cols(header_cols)
+                               , _compose(compose_)
+                              {}
+
+      std::size_t             num_rows() const override     { return _num_rows; }
+      std::size_t             num_cols() const override     { return _num_cols; }
+      float                   row_height(std::size_t /*row*/, basic_context const& /*ctx*/) const override { return _row_height; }
+      float                   col_width(std::size_t /*col*/, basic_context const& /*ctx*/) const override { return _col_width; }
+      element_ptr             compose(std::size_t row, std::size_t col) override { return _compose(row, col); }
+      std::size_t             header_rows() const override  { return _header_rows; }
+      std::size_t             header_cols() const override  { return _header_cols; }
+
+   private:
+
+      std::size_t             _num_rows;
+      std::size_t             _num_cols;
+      float                   _col_width;
+      float                   _row_height;
+      std::size_t             _header_rows;
+      std::size_t             _header_cols;
+      F                       _compose;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // basic_table_composer given the number of rows and columns, the column
+   // width, the row height, a compose function, and optionally, the number
+   // of header rows and columns.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F>
+   inline auto basic_table_composer(
+      std::size_t num_rows, std::size_t num_cols
+    , float col_width, float row_height
+    , F&& compose
+    , std::size_t header_rows = 0
+    , std::size_t header_cols = 0
+   )
+   {
+      using ftype = remove_cvref_t<F>;
+      return share(
+         uniform_table_composer<ftype>{
+            num_rows, num_cols
+          , col_width, row_height
+          , std::forward<ftype>(compose)
+          , header_rows, header_cols
+         }
+      );
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // dynamic_table: A two-dimensional dynamic_list. Only the cells within
+   // the visible rectangle are composed, laid out and drawn. The header
+   // rows and columns stick to the top and left of the view when scrolled.
+   // Place it inside a scroller.
+   ////////////////////////////////////////////////////////////////////////////
+   class dynamic_table : public element
+   {
+   public:
+
+      using composer_ptr = std::shared_ptr<table_composer>;
+
+                                 dynamic_table(composer_ptr composer);
+
+      view_limits                limits(basic_context const& ctx) const override;
+      void                       draw(context const& ctx) override;
+      void                       layout(context const& ctx) override;
+
+      void                       update();
+      void                       update(basic_context const& ctx) const;
+
+                                 // The maximum number of offscreen cells kept
+                                 // for reuse, if the composer recycles.
+      std::size_t                pool_size() const          { return _pool_size; }
+      void                       pool_size(std::size_t n);
+
+   private:
+
+      struct cell_info
+      {
+         element_ptr             elem_ptr;
+         int                     layout_id = -1;
+         std::uint64_t           frame = 0;
+      };
+
+      using cell_map = std::unordered_map<std::uint64_t, cell_info>;
+      using extents_tree = detail::fenwick_tree;
+      using span = std::pair<std::size_t, std::size_t>;
+
+      void                       draw_cells(
+                                    context const& ctx, rect region
+                                  , span rows, span cols, point origin
+                                 );
+      element_ptr                compose(std::size_t row, std::size_t col);
+      void                       release(cell_info& cell);
+
+      composer_ptr               _composer;
+      point                      _previous_size;
+      cell_map                   _cells;            // The cells in view
+      std::vector<element_ptr>   _pool;             // Offscreen cells for reuse
+      std::size_t                _pool_size = 64;
+      std::uint64_t              _frame = 0;
+
+      mutable extents_tree       _row_heights;
+      mutable extents_tree       _col_widths;
+      mutable int                _layout_id = 0;
+      mutable bool               _update_request = true;
+   };
+}}
+
+#endif
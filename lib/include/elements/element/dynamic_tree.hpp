@@ -0,0 +1,96 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DYNAMIC_TREE_OCTOBER_19_2026)
+#define ELEMENTS_DYNAMIC_TREE_OCTOBER_19_2026
+
+#include <elements/element/dynamic_list.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The tree provider abstract class. Nodes are identified by provider
+   // defined ids. The children of a node are loaded only when the node is
+   // first expanded. The root itself is not shown; its children are the
+   // top level rows (depth 0).
+   ////////////////////////////////////////////////////////////////////////////
+   class tree_provider : public std::enable_shared_from_this<tree_provider>
+   {
+   public:
+
+      using node_id = std::uint64_t;
+
+      virtual node_id         root() const { return 0; }
+      virtual bool            has_children(node_id node) const = 0;
+      virtual void            load_children(node_id node, std::vector<node_id>& children) = 0;
+
+      virtual element_ptr     compose(node_id node, std::size_t depth, bool expanded) = 0;
+      virtual cell_composer::limits width_limits(basic_context const& ctx) const = 0;
+      virtual float           line_height(node_id node, basic_context const& ctx) const = 0;
+
+                              // Optional cell reuse protocol. See
+                              // cell_composer::recycles and rebind.
+      virtual bool            recycles() const { return false; }
+      virtual bool            rebind(element& /*cell*/, node_id /*node*/, std::size_t /*depth*/, bool /*expanded*/) { return false; }
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // dynamic_tree: A dynamic_list of the visible (expanded) nodes of a tree.
+   // The rows are kept flattened. Expanding or collapsing a node inserts or
+   // erases only the rows of its subtree, using dynamic_list's incremental
+   // updates, and only the visible rows are composed. Nodes remember
+   // whether they were expanded when an ancestor is collapsed.
+   //
+   // Clicking the indent column of a row (indent wide, at depth * indent),
+   // or double clicking anywhere else in the row, toggles the node.
+   // find_row is a linear search, O(n) in the number of visible rows. The provider
+   // composes the whole row, including the indentation and the expand and
+   // collapse indicator.
+   ////////////////////////////////////////////////////////////////////////////
+   class dynamic_tree : public dynamic_list
+   {
+   public:
+
+      using provider_ptr = std::shared_ptr<tree_provider>;
+      using node_id = tree_provider::node_id;
+
+                                 dynamic_tree(provider_ptr provider, float indent = 16);
+
+      bool                       wants_control() const override;
+      bool                       click(context const& ctx, mouse_button btn) override;
+
+      std::size_t                num_rows() const;
+      node_id                    node(std::size_t row) const;
+      std::size_t                depth(std::size_t row) const;
+      bool                       is_expanded(std::size_t row) const;
+      std::size_t                find_row(node_id node) const;
+
+      void                       expand(std::size_t row);
+      void                       collapse(std::size_t row);
+      void                       toggle(std::size_t row);
+
+      float                      indent() const             { return _indent; }
+      void                       indent(float indent_)      { _indent = indent_; }
+
+                                 // Reload the whole tree from the provider
+      void                       update();
+      using dynamic_list::update;
+
+   private:
+
+      class tree_composer;
+      using tree_composer_ptr = std::shared_ptr<tree_composer>;
+
+                                 dynamic_tree(tree_composer_ptr tree, float indent);
+
+      tree_composer_ptr          _tree;
+      float                      _indent;
+   };
+}}
+
+#endif
@@ -63,35 +63,71 @@ namespace cycfi { namespace elements
    // Variants of the gizmo are the hgizmo and vgizmo both having 3 patches
    // allowing resizing in one dimension (horozontally or vertically) only.
    //
+   // Composing the patches is relatively expensive (one transform-and-fill
+   // per patch), so gizmos render the composed image once into an
+   // offscreen pixmap and simply blit that on subsequent draws. The cache
+   // is rendered at device resolution, and blitted 1:1 to the destination
+   // snapped to device pixels. It is rebuilt only when the destination
+   // size (in device pixels) or the device scale changes. Gizmos on a
+   // rotated or skewed canvas are drawn directly.
+   //
    ////////////////////////////////////////////////////////////////////////////
-   class gizmo : public image
+   class basic_gizmo : public image
+   {
+   public:
+
+      using image::image;
+
+      void                    draw(context const& ctx) override;
+
+   protected:
+
+      virtual void            draw_patches(canvas& cnv, rect bounds) const = 0;
+
+   private:
+
+      pixmap_ptr              _cache;
+      point                   _cache_size;         // In device pixels
+      float                   _cache_scale = 0;
+   };
+
+   class gizmo : public basic_gizmo
    {
    public:
                               gizmo(char const* filename, float scale = 1);
                               gizmo(pixmap_ptr pixmap_);
 
       view_limits             limits(basic_context const& ctx) const override;
-      void                    draw(context const& ctx) override;
+
+   protected:
+
+      void                    draw_patches(canvas& cnv, rect bounds) const override;
    };
 
-   class hgizmo : public image
+   class hgizmo : public basic_gizmo
    {
    public:
                               hgizmo(char const* filename, float scale = 1);
                               hgizmo(pixmap_ptr pixmap_);
 
       view_limits             limits(basic_context const& ctx) const override;
-      void                    draw(context const& ctx) override;
+
+   protected:
+
+      void                    draw_patches(canvas& cnv, rect bounds) const override;
    };
 
-   class vgizmo : public image
+   class vgizmo : public basic_gizmo
    {
    public:
                               vgizmo(char const* filename, float scale = 1);
                               vgizmo(pixmap_ptr pixmap_);
 
       view_limits             limits(basic_context const& ctx) const override;
-      void                    draw(context const& ctx) override;
+
+   protected:
+
+      void                    draw_patches(canvas& cnv, rect bounds) const override;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,85 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_LOG_VIEW_OCTOBER_19_2026)
+#define ELEMENTS_LOG_VIEW_OCTOBER_19_2026
+
+#include <elements/element/element.hpp>
+#include <elements/support/glyphs.hpp>
+#include <elements/support/theme.hpp>
+#include <infra/string_view.hpp>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // log_view: an element for high-rate, append-only text such as logs and
+   // event monitors. It keeps at most max_lines lines, dropping the oldest
+   // ones. Each line is a single row (long lines are clipped, not wrapped),
+   // so only the visible lines are ever shaped, and their shaped glyphs are
+   // cached. Place it inside a vertical scroller. While the last line is in
+   // view, the log view keeps scrolling to the tail as lines are added.
+   //
+   // append may be called from any thread. Appended lines are queued
+   // (lock-free) and added on the UI thread once per batch, with a single
+   // relayout and refresh. clear may only be called on the UI thread.
+   ////////////////////////////////////////////////////////////////////////////
+   class log_view : public element
+   {
+   public:
+                              log_view(
+                                 std::size_t max_lines = 10000
+                               , font font_        = get_theme().text_box_font
+                               , float size        = get_theme().text_box_font_size
+                               , color color_      = get_theme().text_box_font_color
+                              );
+                              log_view(log_view&& rhs);
+      log_view&               operator=(log_view&& rhs);
+
+      view_limits             limits(basic_context const& ctx) const override;
+      void                    layout(context const& ctx) override;
+      void                    draw(context const& ctx) override;
+
+      void                    append(string_view line);
+      void                    clear();
+
+      std::size_t             size() const         { return _lines.size(); }
+      std::size_t             max_lines() const    { return _max_lines; }
+
+   private:
+
+      struct line
+      {
+                              line(std::string text_) : text(std::move(text_)) {}
+
+         std::string          text;
+         std::unique_ptr<master_glyphs> layout;    // Shaped on demand
+      };
+
+      struct queue;
+      using line_ptr = std::unique_ptr<line>;
+
+                              log_view(log_view const&) = delete;
+      log_view&               operator=(log_view const&) = delete;
+
+      float                   line_height() const;
+      bool                    take_lines();
+      void                    drain();
+
+      std::size_t             _max_lines;
+      master_glyphs           _layout;
+      color                   _color;
+      std::deque<line_ptr>    _lines;
+      std::shared_ptr<queue>  _queue;
+      bool                    _at_tail = true;
+      bool                    _scroll_to_tail = false;
+   };
+}}
+
+#endif
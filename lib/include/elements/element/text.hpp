@@ -7,11 +7,14 @@
 #define ELEMENTS_TEXT_APRIL_17_2016
 
 #include <elements/support/glyphs.hpp>
+#include <elements/support/text_buffer.hpp>
 #include <elements/support/theme.hpp>
 #include <elements/element/element.hpp>
 
 #include <infra/string_view.hpp>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace cycfi { namespace elements
@@ -53,29 +56,86 @@ namespace cycfi { namespace elements
                                , color color_      = get_theme().text_box_font_color
                               );
 
-                              static_text_box(static_text_box&& rhs) = default;
+                              static_text_box(static_text_box&& rhs);
+                              ~static_text_box();
 
       view_limits             limits(basic_context const& ctx) const override;
       void                    layout(context const& ctx) override;
       void                    draw(context const& ctx) override;
 
-      std::string const&      get_text() const override            { return _text; }
+      std::string const&      get_text() const override;
       void                    set_text(string_view text) override;
 
-      std::string const&      value() const override           { return _text; }
+      std::string const&      value() const override           { return get_text(); }
       void                    value(string_view val) override;
 
+                              // When more than min_bytes of text need to
+                              // be laid out at once (e.g. set_text with a
+                              // large document), shaping and line breaking
+                              // are done on a worker thread, starting from
+                              // the visible rows. The element is refreshed
+                              // as the rows complete. Pass 0 to always lay
+                              // out synchronously.
+      void                    async_layout(std::size_t min_bytes);
+
    private:
 
-      void                    sync() const;
+      struct layout_job;
+
+      void                    sync();
+      void                    wrap(float width);
+      void                    start_layout_job(context const& ctx);
+      void                    apply_layout_job(view& view_);
 
    protected:
 
-      std::string             _text;
+      // Each line of the text buffer is laid out as a paragraph that keeps
+      // its own shaped glyphs and rows, so that an edit reshapes and
+      // rewraps only the lines it touches. The paragraphs after it are
+      // simply shifted down (or up).
+      struct paragraph
+      {
+                              paragraph(
+                                 text_buffer::line_ptr line
+                               , master_glyphs const& source
+                               , bool shape = true
+                              );
+
+         text_buffer::line_ptr text;               // Excluding the newline
+         master_glyphs        layout;
+         std::vector<glyphs>  rows;
+         float                width = -1;          // The width rows were broken at
+         std::size_t          offset = 0;          // Offset of text in _text
+         std::size_t          first_row = 0;       // Index of the first row
+         bool                 shaped = true;       // False while pending async layout
+      };
+
+      using row_range = std::pair<std::size_t, std::size_t>;
+
+      row_range               visible_rows(context const& ctx) const;
+      row_range               update_visible_rows(context const& ctx);
+      std::size_t             find_paragraph(std::size_t row) const;
+      std::size_t             paragraph_at(std::size_t offset) const;
+      std::size_t             row_begin(std::size_t row) const;
+      std::size_t             row_end(std::size_t row) const;
+
+      // Derived classes read and edit the text through _text (it used to be
+      // a std::string). get_text flattens it, once per version, in O(n).
+      text_buffer             _text;
+      mutable std::string     _flat_text;          // _text, flattened for get_text
+      mutable text_buffer     _flat_source;        // The _text that _flat_text is of
       mutable master_glyphs   _layout;
-      std::vector<glyphs>     _rows;
+      std::vector<paragraph>  _paragraphs;
+      std::size_t             _num_rows = 0;
       color                   _color;
       point                   _current_size = { -1, -1 };
+
+   private:
+
+      std::size_t             _async_min_bytes = 256 * 1024;
+      std::shared_ptr<layout_job> _job;
+      bool                    _needs_job = false;
+      std::size_t             _first_visible_row = 0;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -128,28 +188,56 @@ namespace cycfi { namespace elements
       virtual void            copy(view& v, int start, int end);
       virtual void            paste(view& v, int start, int end);
 
+      // All edits to the text go through replace_text, which records them
+      // in the undo journal.
+      void                    replace_text(std::size_t pos, std::size_t n, string_view text);
+
    private:
 
       struct glyph_metrics
       {
-         char const* str;           // The start of the utf8 string
+         int         index;         // Where the utf8 string starts, or -1
          point       pos;           // Position where glyph is drawn
          rect        bounds;        // Glyph bounds
          float       line_height;   // Line height
       };
 
-      char const*             caret_position(context const& ctx, point p);
-      glyph_metrics           glyph_info(context const& ctx, char const* s);
+      std::pair<int, int>     visible_text(context const& ctx) const;
+      int                     caret_position(context const& ctx, point p);
+      glyph_metrics           glyph_info(context const& ctx, int index);
+      char const*             utf8_at(int index) const;
 
-      struct state_saver;
-      using state_saver_f = std::function<void()>;
+      // Undo is journaled as compact edit deltas rather than snapshots.
+      // Each undo step holds the edits made (since the previous mark) and
+      // the selections before and after. Consecutive edits within a step
+      // (e.g. a typing run) are coalesced into one.
+      struct text_edit
+      {
+         std::size_t          pos;
+         std::string          removed;
+         std::string          inserted;
+      };
+
+      struct undo_mark
+      {
+         std::size_t          edit;          // Index into _edits
+         int                  select_start;
+         int                  select_end;
+      };
 
-      state_saver_f           capture_state();
+      undo_mark               mark_undo();
+      void                    add_undo(view& v, undo_mark const& from, undo_mark const& to);
+      void                    commit_typing(view& v, undo_mark const& to);
+      void                    commit_undo(view& v, undo_mark const& from);
 
       int                     _select_start;
       int                     _select_end;
       float                   _current_x;
-      state_saver_f           _typing_state;
+      std::vector<text_edit>  _edits;
+      std::size_t             _edit_floor = 0;
+      std::size_t             _undo_generation = 0;   // Bumped by set_text
+      undo_mark               _typing_mark;
+      bool                    _is_typing : 1;
       bool                    _is_focus : 1;
       bool                    _show_caret : 1;
       bool                    _caret_started : 1;
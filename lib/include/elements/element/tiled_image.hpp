@@ -0,0 +1,116 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TILED_IMAGE_OCTOBER_19_2026)
+#define ELEMENTS_TILED_IMAGE_OCTOBER_19_2026
+
+#include <elements/element/element.hpp>
+#include <elements/support/pixmap.hpp>
+#include <infra/filesystem.hpp>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // Tile sources provide the tiles of an image pyramid. Level 0 is the
+   // full resolution image. Each subsequent level is half the size of the
+   // previous one (rounded up), down to the level that fits in a single
+   // tile. All tiles are tile_size x tile_size pixels, except for those at
+   // the right and bottom edges, which may be smaller.
+   //
+   // load is called from worker threads and must be thread-safe. It
+   // returns nullptr if the tile is not available.
+   ////////////////////////////////////////////////////////////////////////////
+   class tile_source
+   {
+   public:
+
+      virtual                 ~tile_source() = default;
+
+      virtual point           size() const = 0;
+      virtual int             tile_size() const = 0;
+      virtual pixmap_ptr      load(int level, int col, int row) const = 0;
+
+      int                     num_levels() const;
+      point                   level_size(int level) const;
+   };
+
+   using tile_source_ptr = std::shared_ptr<tile_source>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // A tile_source that reads tiles from a local directory, laid out as:
+   //
+   //    <path>/<level>/<col>_<row><ext>
+   //
+   // for example, "map/0/12_7.jpg".
+   ////////////////////////////////////////////////////////////////////////////
+   class tile_directory : public tile_source
+   {
+   public:
+                              tile_directory(
+                                 fs::path const& path, point size,
+                                 int tile_size = 256, std::string ext = ".png"
+                              );
+
+      point                   size() const override      { return _size; }
+      int                     tile_size() const override { return _tile_size; }
+      pixmap_ptr              load(int level, int col, int row) const override;
+
+   private:
+
+      fs::path                _path;
+      point                   _size;
+      int                     _tile_size;
+      std::string             _ext;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tiled_image displays very large images from a tile_source. Only the
+   // visible tiles are loaded, at the level of detail that best matches the
+   // current zoom and device scale. Tiles are loaded asynchronously on
+   // worker threads and kept in an LRU cache of at most cache_size tiles
+   // (or as many as are visible, if more).
+   // While a tile is loading, the best available coarser level is drawn
+   // in its place. Place it inside a scroller for panning.
+   ////////////////////////////////////////////////////////////////////////////
+   class tiled_image : public element
+   {
+   public:
+                              tiled_image(
+                                 tile_source_ptr source,
+                                 std::size_t cache_size = 256
+                              );
+
+      view_limits             limits(basic_context const& ctx) const override;
+      void                    draw(context const& ctx) override;
+
+      float                   zoom() const               { return _zoom; }
+      void                    zoom(float zoom_)          { _zoom = zoom_; }
+
+   private:
+
+      using tile_key = std::uint64_t;
+      struct tile_cache;
+
+      static tile_key         make_key(int level, int col, int row);
+
+      pixmap const*           find_tile(tile_key key);
+      void                    request_tile(context const& ctx, int level, int col, int row);
+      bool                    draw_tile(
+                                 context const& ctx, int level, int col, int row,
+                                 rect dest, int max_level
+                              );
+
+      tile_source_ptr         _source;
+      float                   _zoom = 1;
+      std::shared_ptr<tile_cache> _cache;
+   };
+}}
+
+#endif
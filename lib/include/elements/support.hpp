@@ -19,6 +19,7 @@
 #include <elements/support/point.hpp>
 #include <elements/support/rect.hpp>
 #include <elements/support/draw_utils.hpp>
+#include <elements/support/text_buffer.hpp>
 #include <elements/support/text_utils.hpp>
 #include <elements/support/theme.hpp>
 
@@ -165,9 +165,17 @@ namespace cycfi { namespace elements
       ///////////////////////////////////////////////////////////////////////////////////
       // Pixmaps
 
+      struct blit
+      {
+         elements::rect    src;
+         elements::rect    dest;
+      };
+
       void              draw(pixmap const& pm, elements::rect src, elements::rect dest);
       void              draw(pixmap const& pm, elements::rect dest);
       void              draw(pixmap const& pm, point pos);
+      void              draw_many(pixmap const& pm, blit const* blits, std::size_t count);
+      void              draw_many(pixmap const& pm, std::vector<blit> const& blits);
 
       ///////////////////////////////////////////////////////////////////////////////////
       // States
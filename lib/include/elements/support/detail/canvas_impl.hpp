@@ -74,6 +74,11 @@ namespace cycfi { namespace elements
       draw(pm, { 0, 0, pm.size() }, { pos, pm.size() });
    }
 
+   inline void canvas::draw_many(pixmap const& pm, std::vector<blit> const& blits)
+   {
+      draw_many(pm, blits.data(), blits.size());
+   }
+
    inline canvas::state::state(canvas& cnv_)
      : cnv(&cnv_)
    {
@@ -0,0 +1,183 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DETAIL_FENWICK_TREE_OCTOBER_19_2026)
+#define ELEMENTS_DETAIL_FENWICK_TREE_OCTOBER_19_2026
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace cycfi { namespace elements { namespace detail
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // fenwick_tree: A sequence of (non-negative) extents, such as row heights
+   // or column widths, with O(log n) prefix sums (positions), position
+   // lookups, updates and appends. Inserting, erasing or moving in the
+   // middle shifts the extents and rebuilds the tree in O(n), lazily, on
+   // the next query.
+   ////////////////////////////////////////////////////////////////////////////
+   class fenwick_tree
+   {
+   public:
+
+      std::size_t          size() const               { return _values.size(); }
+      bool                 empty() const              { return _values.empty(); }
+      double               operator[](std::size_t i) const { return _values[i]; }
+
+      void                 clear();
+      void                 reserve(std::size_t n);
+      void                 push_back(double value);
+      void                 set(std::size_t i, double value);
+      void                 insert(std::size_t i, std::size_t count, double value);
+      void                 erase(std::size_t i, std::size_t count);
+      void                 move(std::size_t from, std::size_t to);
+
+                           // Sum of the extents [0, i), i.e. the position
+                           // of the ith item.
+      double               prefix(std::size_t i) const;
+      double               total() const              { return prefix(size()); }
+
+                           // The largest k such that prefix(k) < pos, and
+                           // the largest k such that prefix(k) <= pos.
+      std::size_t          find_lower(double pos) const;
+      std::size_t          find_upper(double pos) const;
+
+   private:
+
+      void                 rebuild() const;
+
+      template <typename Less>
+      std::size_t          find(double pos, Less less) const;
+
+      std::vector<double>  _values;
+      mutable std::vector<double> _tree;     // 1-based
+      mutable bool         _dirty = false;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   inline void fenwick_tree::clear()
+   {
+      _values.clear();
+      _tree.clear();
+      _dirty = true;  // Build in one go after a bulk push_back
+   }
+
+   inline void fenwick_tree::reserve(std::size_t n)
+   {
+      _values.reserve(n);
+      _tree.reserve(n + 1);
+   }
+
+   inline void fenwick_tree::push_back(double value)
+   {
+      _values.push_back(value);
+      if (_dirty)
+         return;
+
+      // The new node n covers the items (n - lowbit(n), n]
+      std::size_t n = _values.size();
+      std::size_t low = n & (~n + 1);
+      _tree.resize(std::max<std::size_t>(_tree.size(), 1));
+      _tree.push_back(value + prefix(n - 1) - prefix(n - low));
+   }
+
+   inline void fenwick_tree::set(std::size_t i, double value)
+   {
+      auto delta = value - _values[i];
+      _values[i] = value;
+      if (_dirty)
+         return;
+      for (auto n = i + 1; n < _tree.size(); n += n & (~n + 1))
+         _tree[n] += delta;
+   }
+
+   inline void fenwick_tree::insert(std::size_t i, std::size_t count, double value)
+   {
+      if (i == _values.size() && count == 1)
+         return push_back(value);
+      _values.insert(_values.begin() + i, count, value);
+      _dirty = true;
+   }
+
+   inline void fenwick_tree::erase(std::size_t i, std::size_t count)
+   {
+      _values.erase(_values.begin() + i, _values.begin() + i + count);
+      _dirty = true;
+   }
+
+   inline void fenwick_tree::move(std::size_t from, std::size_t to)
+   {
+      if (from < to)
+         std::rotate(_values.begin() + from, _values.begin() + from + 1, _values.begin() + to + 1);
+      else if (to < from)
+         std::rotate(_values.begin() + to, _values.begin() + from, _values.begin() + from + 1);
+      _dirty = true;
+   }
+
+   inline double fenwick_tree::prefix(std::size_t i) const
+   {
+      if (_dirty)
+         rebuild();
+      double sum = 0;
+      for (; i > 0; i -= i & (~i + 1))
+         sum += _tree[i];
+      return sum;
+   }
+
+   inline std::size_t fenwick_tree::find_lower(double pos) const
+   {
+      return find(pos, [](double a, double b) { return a < b; });
+   }
+
+   inline std::size_t fenwick_tree::find_upper(double pos) const
+   {
+      return find(pos, [](double a, double b) { return a <= b; });
+   }
+
+   template <typename Less>
+   inline std::size_t fenwick_tree::find(double pos, Less less) const
+   {
+      if (_dirty)
+         rebuild();
+
+      // Descend the tree from the highest power of two
+      std::size_t n = _values.size();
+      std::size_t step = 1;
+      while (step * 2 <= n)
+         step *= 2;
+
+      std::size_t k = 0;
+      double      sum = 0;
+      for (; step; step /= 2)
+      {
+         if (k + step <= n && less(sum + _tree[k + step], pos))
+         {
+            k += step;
+            sum += _tree[k];
+         }
+      }
+      return k;
+   }
+
+   inline void fenwick_tree::rebuild() const
+   {
+      // Linear time construction
+      std::size_t n = _values.size();
+      _tree.assign(n + 1, 0.0);
+      for (std::size_t i = 1; i <= n; ++i)
+      {
+         _tree[i] += _values[i - 1];
+         auto parent = i + (i & (~i + 1));
+         if (parent <= n)
+            _tree[parent] += _tree[i];
+      }
+      _dirty = false;
+   }
+}}}
+
+#endif
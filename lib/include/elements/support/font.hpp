@@ -8,6 +8,7 @@
 
 #include <infra/string_view.hpp>
 #include <infra/filesystem.hpp>
+#include <string>
 #include <vector>
 
 extern "C"
@@ -92,6 +93,8 @@ namespace cycfi { namespace elements
       uint8_t              _stretch = font_constants::stretch_normal;
    };
 
+   struct glyph_warmup;
+
    class font
    {
    public:
@@ -107,9 +110,34 @@ namespace cycfi { namespace elements
    private:
 
       friend class canvas;
+      friend void          warm_up_glyphs(glyph_warmup const& warmup, float scale);
       cairo_font_face_t*  _handle   = nullptr;
    };
 
+   ////////////////////////////////////////////////////////////////////////////
+   // Glyph cache warmup. The first time a glyph is drawn at a given size,
+   // it is rasterized on the spot. warm_up_glyphs pre-renders the glyphs
+   // of chars (utf8) in the given font and size, on a worker thread, so
+   // that the first paint of a screen does not have to. scale is the
+   // device (hdpi) scale the glyphs will be drawn at. Requests that were
+   // already made are ignored.
+   //
+   // The glyphs are rendered to an image surface with the default font
+   // options, so the warmed glyph cache is hit only when the view draws to
+   // an image surface with default font options. On other backends, this
+   // only loads the font faces ahead of time. Hence, warmup is opt-in:
+   // the library never calls it on its own.
+   ////////////////////////////////////////////////////////////////////////////
+   struct glyph_warmup
+   {
+      font                 typeface;
+      float                size;
+      std::string          chars;
+   };
+
+   void                    warm_up_glyphs(glyph_warmup const& warmup, float scale = 1);
+   void                    warm_up_glyphs(std::vector<glyph_warmup> const& warmups, float scale = 1);
+
    ////////////////////////////////////////////////////////////////////////////
    // Inlines
    ////////////////////////////////////////////////////////////////////////////
@@ -311,6 +339,24 @@ namespace cycfi { namespace elements
 #endif
 
    std::vector<fs::path>& font_paths();
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Persistent font index. Fonts are resolved lazily, one family at a time,
+   // as they are requested. When enabled, the resolved families are saved
+   // to the index file so that, on later launches, fonts are found without
+   // even loading the system font configuration. The index is rebuilt
+   // whenever the font directories (or the application's font_paths) change.
+   //
+   // Call before constructing any font. The index is disabled by default.
+   // An empty path enables the index in the default location:
+   // app_data_path() / "elements" / "font_index".
+   //
+   // Newly resolved families are written once, at exit, or earlier with
+   // flush_font_index (e.g. once the application's UI is up).
+   ////////////////////////////////////////////////////////////////////////////
+   void enable_font_index(fs::path const& path = {});
+   void disable_font_index();
+   void flush_font_index();
 }}
 
 #endif
@@ -34,6 +34,13 @@ namespace cycfi { namespace elements
                            );
 
       void                 draw(point pos, canvas& canvas_);
+
+                           // Draw or measure only the glyphs of the
+                           // clusters in [first, last), at the same
+                           // positions they have in the whole. For lines
+                           // of a master_glyphs only.
+      void                 draw(point pos, canvas& canvas_, char const* first, char const* last);
+      bool                 extent(char const* first, char const* last, float& left, float& right) const;
       float                width() const;
 
                            // for_each F signature:
@@ -41,6 +48,16 @@ namespace cycfi { namespace elements
                            template <typename F>
       void                 for_each(F f);
 
+                           // Hit testing. glyph_at returns the glyph at x
+                           // (relative to the start of the glyphs), or
+                           // nullptr if there is none. glyph_bounds gets
+                           // the bounds of the first glyph at or after
+                           // utf8, returning nullptr if there is none.
+                           // Both are O(log n) for the lines of a
+                           // master_glyphs.
+      char const*          glyph_at(float x) const;
+      char const*          glyph_bounds(char const* utf8, float& left, float& right) const;
+
       std::size_t          size() const      { return _last - _first; }
       char const*          begin() const     { return _first; }
       char const*          end() const       { return _last; }
@@ -55,6 +72,9 @@ namespace cycfi { namespace elements
       font_metrics         metrics() const;
 
    protected:
+
+      friend class master_glyphs;
+
                            glyphs(char const* first, char const* last);
 
       using scaled_font = cairo_scaled_font_t;
@@ -66,10 +86,21 @@ namespace cycfi { namespace elements
       char const*          _last;
       scaled_font*         _scaled_font   = nullptr;
       glyph*               _glyphs        = nullptr;
+      float const*         _advances      = nullptr;
       int                  _glyph_count   = 0;
       cluster*             _clusters      = nullptr;
       int                  _cluster_count = 0;
       cluster_flags        _clusterflags;
+
+      bool                 cluster_range(char const* first, char const* last, int& c1, int& c2) const;
+
+      // For lines of a master_glyphs: the master's first glyph and byte
+      // offset of each of our clusters, and the master's indices of our
+      // first glyph and byte.
+      int const*           _cluster_glyphs = nullptr;
+      int const*           _cluster_bytes  = nullptr;
+      int                  _glyph_base     = 0;
+      int                  _byte_base      = 0;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -129,10 +160,32 @@ namespace cycfi { namespace elements
       void                 text(std::string const& str, point start = { 0, 0 });
 
    private:
+
+      friend class glyphs;
+
                            master_glyphs(master_glyphs const&) = delete;
       master_glyphs&       operator=(master_glyphs const& rhs) = delete;
 
       void                 build(point start = { 0, 0 });
+      void                 build_breaks();
+      void                 add_line(int first, int last, bool strip, std::vector<glyphs>& lines);
+
+      // Per-glyph advances, computed once in build()
+      std::vector<float>   _advance_buffer;
+
+      // Per-cluster line breaking data, computed once in build(), so that
+      // wrapping at a given width is a few binary searches per line.
+      struct line_breaks
+      {
+         std::vector<int>     glyph;      // First glyph of each cluster, plus the end
+         std::vector<int>     byte;       // Byte offset of each cluster, plus the end
+         std::vector<float>   right;      // Right edge of each cluster (non-decreasing)
+         std::vector<int>     spaces;     // Clusters that are spaces
+         std::vector<int>     newlines;   // Clusters that are newlines
+         std::vector<int>     soft;       // Clusters that follow a punctuation
+      };
+
+      line_breaks          _breaks;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -181,13 +234,13 @@ namespace cycfi { namespace elements
    template <typename F>
    inline void glyphs::for_each(F f)
    {
+      if (_first == _last)
+         return;
+
       CYCFI_ASSERT(_scaled_font, "Precondition failure: _scaled_font must not be null");
       CYCFI_ASSERT(_glyphs, "Precondition failure: _glyphs must not be null");
       CYCFI_ASSERT(_clusters, "Precondition failure: _clusters must not be null");
 
-      if (_first == _last)
-         return;
-
       int   glyph_index = 0;
       int   byte_index = 0;
       float start_x = _glyphs->x;
@@ -196,11 +249,9 @@ namespace cycfi { namespace elements
       {
          cairo_text_cluster_t* cluster = _clusters + i;
          cairo_glyph_t* glyph = _glyphs + glyph_index;
-         cairo_text_extents_t extents;
-         cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
 
          float x = glyph->x - start_x;
-         if (!f(_first + byte_index, x, x + extents.x_advance))
+         if (!f(_first + byte_index, x, x + _advances[glyph_index]))
             break;
 
          // glyph/byte position
@@ -6,10 +6,12 @@
 #if !defined(ELEMENTS_PIXMAP_SEPTEMBER_5_2016)
 #define ELEMENTS_PIXMAP_SEPTEMBER_5_2016
 
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <cairo.h>
 #include <elements/support/point.hpp>
+#include <infra/filesystem.hpp>
 #include <stdexcept>
 
 namespace cycfi { namespace elements
@@ -24,12 +26,39 @@ namespace cycfi { namespace elements
       using std::runtime_error::runtime_error;
    };
 
+   ////////////////////////////////////////////////////////////////////////////
+   // Pixel formats. argb32 is full color with (premultiplied) alpha. rgb24
+   // is for opaque images; these are blitted without blending. a8 is an
+   // alpha-only mask (a quarter of the memory of argb32). Masks have no
+   // color of their own and are painted using the canvas' current fill
+   // style, which makes recoloring (e.g. tinting icons) essentially free.
+   //
+   // When loading from a file, pixmap_format::automatic picks rgb24 for
+   // images without an alpha channel (or whose pixels are all opaque) and
+   // argb32 for everything else. Request a8 explicitly to load a file as a
+   // mask. The mask is taken from the alpha channel, if the image has one,
+   // or from the luminance otherwise.
+   ////////////////////////////////////////////////////////////////////////////
+   enum class pixmap_format
+   {
+      automatic,
+      argb32,
+      rgb24,
+      a8
+   };
+
    class pixmap
    {
    public:
 
-      explicit          pixmap(point size, float scale = 1);
-      explicit          pixmap(char const* filename, float scale = 1);
+      explicit          pixmap(
+                           point size, float scale = 1,
+                           pixmap_format format = pixmap_format::argb32
+                        );
+      explicit          pixmap(
+                           char const* filename, float scale = 1,
+                           pixmap_format format = pixmap_format::automatic
+                        );
                         pixmap(pixmap const& rhs) = delete;
                         pixmap(pixmap&& rhs);
                         ~pixmap();
@@ -40,6 +69,9 @@ namespace cycfi { namespace elements
       extent            size() const;
       float             scale() const;
       void              scale(float val);
+      pixmap_format     format() const;
+      bool              is_opaque() const;
+      bool              is_mask() const;
 
    private:
 
@@ -51,6 +83,23 @@ namespace cycfi { namespace elements
 
    using pixmap_ptr = std::shared_ptr<pixmap>;
 
+   ////////////////////////////////////////////////////////////////////////////
+   // Decoded image disk cache. Decoding PNGs and JPEGs on every launch can
+   // dominate the startup time of applications with many image resources.
+   // When enabled, pixmaps loaded from files are written, fully decoded and
+   // premultiplied, to the cache directory. Subsequent loads of the same
+   // file (keyed by full path, modification time and requested format)
+   // memory-map the cached pixels directly with no decoding at all.
+   //
+   // The cache is disabled by default. An empty path enables the cache in
+   // the default location: app_data_path() / "elements" / "pixmap_cache".
+   // Whenever a file is added, the files written longest ago are removed
+   // until the cache is within max_bytes (0 for no limit). The cache directory may also be
+   // deleted at any time while no application is using it.
+   ////////////////////////////////////////////////////////////////////////////
+   void enable_pixmap_cache(fs::path const& path = {}, std::uintmax_t max_bytes = 256 * 1024 * 1024);
+   void disable_pixmap_cache();
+
    ////////////////////////////////////////////////////////////////////////////
    // pixmap_context allows drawing into a pixmap
    ////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,146 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TEXT_BUFFER_OCTOBER_19_2026)
+#define ELEMENTS_TEXT_BUFFER_OCTOBER_19_2026
+
+#include <infra/string_view.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // text_buffer: an editable utf8 text, stored as a persistent balanced
+   // tree of lines (a rope whose leaves are the lines, sans the newlines).
+   //
+   // Edits copy only the lines they touch, plus O(log n) tree nodes. All
+   // the rest is shared with the previous version. Hence, copying a
+   // text_buffer is O(1), making it ideal for undo snapshots. The lines
+   // themselves are immutable. A line that was not touched by an edit is
+   // the very same object before and after, which clients may use to
+   // cache per-line data (e.g. shaped glyphs).
+   //
+   // Positions are byte offsets into the text, newlines included.
+   ////////////////////////////////////////////////////////////////////////////
+   class text_buffer
+   {
+   public:
+
+      using line_ptr = std::shared_ptr<std::string const>;
+
+                           text_buffer();
+                           text_buffer(string_view text);
+
+      std::size_t          size() const;
+      bool                 empty() const        { return size() == 0; }
+      std::size_t          num_lines() const;
+
+      std::string          str() const;
+      std::string          substr(std::size_t pos, std::size_t n) const;
+      line_ptr             line(std::size_t i) const;
+      string_view          line_at(std::size_t pos, std::size_t& line_start) const;
+      bool                 shares(text_buffer const& other) const;
+
+      std::size_t          next(std::size_t pos) const;
+      std::size_t          prev(std::size_t pos) const;
+
+      void                 insert(std::size_t pos, string_view text);
+      void                 erase(std::size_t pos, std::size_t n);
+      void                 replace(std::size_t pos, std::size_t n, string_view text);
+
+                           // F signature: bool f(line_ptr const& line);
+                           // Return false to stop.
+                           template <typename F>
+      void                 for_each_line(F f, std::size_t first = 0) const;
+
+                           template <typename F>
+      void                 for_each_line_reverse(F f) const;
+
+   private:
+
+      friend struct text_buffer_detail;
+
+      struct node;
+      using node_ptr = std::shared_ptr<node const>;
+
+      struct node
+      {
+         node_ptr          left;
+         node_ptr          right;
+         line_ptr          line;
+         int               height;
+         std::size_t       lines;   // Number of lines in this subtree
+         std::size_t       bytes;   // Number of bytes in this subtree, sans newlines
+      };
+
+      template <typename F>
+      static bool          for_each_line(node const* n, std::size_t first, F& f);
+
+      template <typename F>
+      static bool          for_each_line_reverse(node const* n, F& f);
+
+      node_ptr             _root;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F>
+   inline bool text_buffer::for_each_line(node const* n, std::size_t first, F& f)
+   {
+      if (!n)
+         return true;
+      std::size_t left_lines = n->left ? n->left->lines : 0;
+      if (first < left_lines && !for_each_line(n->left.get(), first, f))
+         return false;
+      if (first <= left_lines && !f(n->line))
+         return false;
+      return for_each_line(
+         n->right.get(), first > left_lines ? first - left_lines - 1 : 0, f);
+   }
+
+   template <typename F>
+   inline bool text_buffer::for_each_line_reverse(node const* n, F& f)
+   {
+      if (!n)
+         return true;
+      if (!for_each_line_reverse(n->right.get(), f))
+         return false;
+      if (!f(n->line))
+         return false;
+      return for_each_line_reverse(n->left.get(), f);
+   }
+
+   template <typename F>
+   inline void text_buffer::for_each_line(F f, std::size_t first) const
+   {
+      for_each_line(_root.get(), first, f);
+   }
+
+   template <typename F>
+   inline void text_buffer::for_each_line_reverse(F f) const
+   {
+      for_each_line_reverse(_root.get(), f);
+   }
+
+   inline bool text_buffer::shares(text_buffer const& other) const
+   {
+      return _root == other._root;
+   }
+
+   inline void text_buffer::insert(std::size_t pos, string_view text)
+   {
+      replace(pos, 0, text);
+   }
+
+   inline void text_buffer::erase(std::size_t pos, std::size_t n)
+   {
+      replace(pos, n, {});
+   }
+}}
+
+#endif
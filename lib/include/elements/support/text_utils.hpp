@@ -27,6 +27,21 @@ namespace cycfi { namespace elements
    char const*    prev_utf8(char const* start, char const* utf8);
    unsigned       codepoint(char const*& utf8);
 
+   ////////////////////////////////////////////////////////////////////////////
+   // Bulk UTF8 scanning. These skip runs of ASCII a block at a time (using
+   // SSE2 where available), falling back to the byte-at-a-time decoder
+   // only for the non-ASCII bytes, so that scanning large texts is memory
+   // bound. codepoint_index maps a byte offset (pos) to a codepoint index
+   // and utf8_offset maps a codepoint index back to a position (clamped to
+   // last). repair_utf8 replaces invalid sequences with U+FFFD.
+   ////////////////////////////////////////////////////////////////////////////
+   char const*    skip_ascii(char const* first, char const* last);
+   bool           validate_utf8(char const* first, char const* last);
+   std::size_t    count_codepoints(char const* first, char const* last);
+   std::size_t    codepoint_index(char const* first, char const* pos);
+   char const*    utf8_offset(char const* first, char const* last, std::size_t index);
+   std::string    repair_utf8(char const* first, char const* last);
+
    ////////////////////////////////////////////////////////////////////////////
    inline bool is_space(unsigned codepoint)
    {
@@ -172,6 +187,11 @@ namespace cycfi { namespace elements
       ++utf8; // one past the last byte
       return cp;
    }
+
+   inline std::size_t codepoint_index(char const* first, char const* pos)
+   {
+      return count_codepoints(first, pos);
+   }
 }}
 
 #endif
@@ -91,6 +91,10 @@ namespace cycfi { namespace elements
    // Set the global theme
    void set_theme(theme const& thm);
 
+   // Pre-render the glyphs of the theme's fonts (see warm_up_glyphs in
+   // font.hpp). This is opt-in: nothing calls it by default.
+   void warm_up_glyphs(theme const& thm, float scale = 1);
+
    template <typename T>
    class scoped_theme_override
    {
@@ -16,8 +16,10 @@
 #include <elements/element/indirect.hpp>
 #include <asio.hpp>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <chrono>
+#include <deque>
 #include <map>
 
 namespace cycfi { namespace elements
@@ -25,6 +27,33 @@ namespace cycfi { namespace elements
    class context;
    class window;
    class idle_tasks;
+   class view;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // view_handle: For posting to a view from other threads that may outlive
+   // it. Posting through the handle after the view is gone does nothing.
+   ////////////////////////////////////////////////////////////////////////////
+   class view_handle
+   {
+   public:
+
+                              template <typename F>
+      void                    post(F f) const;
+
+   private:
+
+      friend class view;
+
+      struct link
+      {
+                              link(view* v) : view_(v) {}
+
+         std::mutex           mutex;
+         view*                view_;
+      };
+
+      std::shared_ptr<link>   _link;
+   };
 
    class view : public base_view
    {
@@ -56,10 +85,15 @@ namespace cycfi { namespace elements
       void                    refresh(context const& ctx, int outward = 0);
       rect                    dirty() const;
 
+      // Undo/redo. Tasks should hold compact deltas rather than full
+      // snapshots, and report their (approximate) memory footprint in
+      // size. The oldest undo tasks are dropped when there are more than
+      // max_steps of them, or when their total size exceeds max_bytes.
       struct undo_redo_task
       {
          std::function<void()> undo;
          std::function<void()> redo;
+         std::size_t          size = 0;
       };
 
       void                    add_undo(undo_redo_task t);
@@ -67,6 +101,7 @@ namespace cycfi { namespace elements
       bool                    has_redo();
       bool                    undo();
       bool                    redo();
+      void                    undo_limits(std::size_t max_steps, std::size_t max_bytes);
 
       using content_type = layer_composite;
       using layers_type = layer_composite::container_type;
@@ -105,6 +140,8 @@ namespace cycfi { namespace elements
                               template <typename F>
       void                    post(F f);
 
+      view_handle             handle() const;
+
       using tracking = element::tracking;
 
       using track_function = std::function<void(element& e, tracking state)>;
@@ -127,9 +164,14 @@ namespace cycfi { namespace elements
       mouse_button            _current_button;
       bool                    _is_focus = false;
 
-      using undo_stack_type = std::stack<undo_redo_task>;
+      void                    trim_undo();
+
+      using undo_stack_type = std::deque<undo_redo_task>;
       undo_stack_type         _undo_stack;
       undo_stack_type         _redo_stack;
+      std::size_t             _undo_bytes = 0;
+      std::size_t             _max_undo_steps = 1000;
+      std::size_t             _max_undo_bytes = 64 * 1024 * 1024;
 
       io_context              _io;
       io_context::work        _work;
@@ -138,6 +180,7 @@ namespace cycfi { namespace elements
       using tracking_map = std::map<element*, time_point>;
 
       tracking_map            _tracking;
+      std::shared_ptr<view_handle::link> _link = std::make_shared<view_handle::link>(this);
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -324,6 +367,23 @@ namespace cycfi { namespace elements
    {
       _io.post(f);
    }
+
+   inline view_handle view::handle() const
+   {
+      view_handle h;
+      h._link = _link;
+      return h;
+   }
+
+   template <typename F>
+   inline void view_handle::post(F f) const
+   {
+      if (!_link)
+         return;
+      std::lock_guard<std::mutex> lock(_link->mutex);
+      if (_link->view_)
+         _link->view_->post(std::move(f));
+   }
 }}
 
 #endif
@@ -0,0 +1,365 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/code_text.hpp>
+#include <elements/support/context.hpp>
+#include <algorithm>
+#include <cctype>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // c_like_tokenizer
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      enum : tokenizer::state_type
+      {
+         normal_state
+       , block_comment_state
+      };
+
+      bool is_ident_start(char c)
+      {
+         return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+      }
+
+      bool is_ident(char c)
+      {
+         return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+      }
+   }
+
+   c_like_tokenizer::c_like_tokenizer(std::vector<std::string> keywords)
+    : _keyword_list(std::move(keywords))
+    , _keywords(_keyword_list.begin(), _keyword_list.end())
+   {}
+
+   // _keywords views the strings in _keyword_list, so copies rebuild it
+   // from their own. There are no moves: moving short strings would move
+   // their characters too.
+   c_like_tokenizer::c_like_tokenizer(c_like_tokenizer const& rhs)
+    : _keyword_list(rhs._keyword_list)
+    , _keywords(_keyword_list.begin(), _keyword_list.end())
+   {}
+
+   c_like_tokenizer& c_like_tokenizer::operator=(c_like_tokenizer const& rhs)
+   {
+      if (this != &rhs)
+      {
+         _keyword_list = rhs._keyword_list;
+         _keywords = { _keyword_list.begin(), _keyword_list.end() };
+      }
+      return *this;
+   }
+
+   tokenizer::state_type c_like_tokenizer::tokenize(
+      string_view line
+    , state_type state
+    , std::vector<style_span>& spans
+   ) const
+   {
+      auto const  npos = string_view::npos;
+      std::size_t n = line.size();
+      std::size_t i = 0;
+
+      auto add = [&](std::size_t first, std::size_t last, style_id style)
+      {
+         if (first < last)
+            spans.push_back({ std::uint32_t(first), std::uint32_t(last), style });
+      };
+
+      // Continue a block comment from the previous line
+      if (state == block_comment_state)
+      {
+         auto end = line.find("*/");
+         if (end == npos)
+         {
+            add(0, n, comment_style);
+            return block_comment_state;
+         }
+         add(0, end + 2, comment_style);
+         i = end + 2;
+      }
+
+      while (i < n)
+      {
+         char c = line[i];
+         char next = (i + 1 < n)? line[i + 1] : 0;
+
+         if (c == '/' && next == '/')
+         {
+            add(i, n, comment_style);
+            break;
+         }
+         else if (c == '/' && next == '*')
+         {
+            auto end = line.find("*/", i + 2);
+            if (end == npos)
+            {
+               add(i, n, comment_style);
+               return block_comment_state;
+            }
+            add(i, end + 2, comment_style);
+            i = end + 2;
+         }
+         else if (c == '"' || c == '\'')
+         {
+            auto j = i + 1;
+            while (j < n && line[j] != c)
+               j += (line[j] == '\\')? 2 : 1;
+            j = std::min(j + 1, n);
+            add(i, j, string_style);
+            i = j;
+         }
+         else if (std::isdigit(static_cast<unsigned char>(c)))
+         {
+            auto j = i + 1;
+            while (j < n && (is_ident(line[j]) || line[j] == '.' || line[j] == '\''))
+               ++j;
+            add(i, j, number_style);
+            i = j;
+         }
+         else if (is_ident_start(c))
+         {
+            auto j = i + 1;
+            while (j < n && is_ident(line[j]))
+               ++j;
+            if (_keywords.count(line.substr(i, j - i)))
+               add(i, j, keyword_style);
+            i = j;
+         }
+         else
+         {
+            ++i;
+         }
+      }
+      return normal_state;
+   }
+
+   std::vector<text_style> default_code_styles()
+   {
+      return {
+         { get_theme().text_box_font_color }          // plain_style
+       , { rgba(0x82aaffff), true }                   // keyword_style
+       , { rgba(0x808890ff) }                         // comment_style
+       , { rgba(0xe5a86bff) }                         // string_style
+       , { rgba(0xa8d48aff) }                         // number_style
+      };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // code_text_box
+   ////////////////////////////////////////////////////////////////////////////
+   code_text_box::code_text_box(
+      std::string text
+    , tokenizer_ptr tokenizer_
+    , std::vector<text_style> styles
+    , font font_
+    , float size
+   )
+    : basic_text_box(std::move(text), font_, size)
+    , _tokenizer(std::move(tokenizer_))
+    , _styles(std::move(styles))
+   {}
+
+   void code_text_box::styles(std::vector<text_style> styles_)
+   {
+      _styles = std::move(styles_);
+   }
+
+   void code_text_box::set_tokenizer(tokenizer_ptr tokenizer_)
+   {
+      _tokenizer = std::move(tokenizer_);
+      _lines.clear();
+      _lexed = 0;
+   }
+
+   void code_text_box::sync_lines()
+   {
+      // Same as static_text_box::sync: the lines an edit did not touch are
+      // the very same objects we hold, so we keep the leading and trailing
+      // lines that are still the same, comparing pointers, and replace the
+      // ones in between with lines yet to be lexed.
+      std::size_t num_infos = _lines.size();
+      std::size_t num_lines = _text.num_lines();
+      std::size_t first = 0;           // First line that changed
+      std::size_t last = num_infos;    // One past the last line that changed
+      std::size_t last_line = num_lines;
+
+      _text.for_each_line(
+         [&](text_buffer::line_ptr const& line)
+         {
+            if (first == num_infos || _lines[first].text != line)
+               return false;
+            ++first;
+            return true;
+         }
+      );
+
+      if (first == num_infos && first == num_lines)
+         return;  // Nothing changed
+
+      _text.for_each_line_reverse(
+         [&](text_buffer::line_ptr const& line)
+         {
+            if (last == first || last_line == first || _lines[last-1].text != line)
+               return false;
+            --last;
+            --last_line;
+            return true;
+         }
+      );
+
+      std::vector<line_info> changed(last_line - first);
+      for (std::size_t i = 0; i != changed.size(); ++i)
+         changed[i].text = _text.line(first + i);
+
+      _lines.erase(_lines.begin() + first, _lines.begin() + last);
+      _lines.insert(
+         _lines.begin() + first
+       , std::make_move_iterator(changed.begin())
+       , std::make_move_iterator(changed.end())
+      );
+      _lexed = std::min(_lexed, first);
+   }
+
+   void code_text_box::lex_through(std::size_t line)
+   {
+      // Re-lex a line only if it is new, or if the state it starts with
+      // has changed (e.g. a block comment was opened or closed above it).
+      // Past the edited lines, that typically stops right away.
+      if (!_tokenizer)
+         return;
+
+      for (; _lexed <= line && _lexed < _lines.size(); ++_lexed)
+      {
+         auto& info = _lines[_lexed];
+         auto  in = (_lexed == 0)? tokenizer::state_type(0) : _lines[_lexed-1].out;
+         if (!info.lexed || info.in != in)
+         {
+            info.spans.clear();
+            info.in = in;
+            info.out = _tokenizer->tokenize(
+               string_view(info.text->data(), info.text->size()), in, info.spans);
+            info.lexed = true;
+         }
+      }
+   }
+
+   void code_text_box::draw(context const& ctx)
+   {
+      draw_selection(ctx);
+      sync_lines();
+      {
+         auto& cnv = ctx.canvas;
+         auto  state = cnv.new_state();
+         auto  metrics = _layout.metrics();
+         auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
+         auto  x = ctx.bounds.left;
+         auto  y = ctx.bounds.top + metrics.ascent;
+
+         cnv.rect(ctx.bounds);
+         cnv.clip();
+
+         // Draw only the rows that are visible, lexing only as far as the
+         // last of them.
+         auto  rows = update_visible_rows(ctx);
+         if (rows.first < rows.second)
+         {
+            // The spans are only valid for the very line they were made
+            // for. Paragraphs that are not of that line (yet) are drawn
+            // plain.
+            bool  synced = _lines.size() == _paragraphs.size();
+            if (synced)
+               lex_through(find_paragraph(rows.second - 1));
+            y += rows.first * line_height;
+            auto  i = find_paragraph(rows.first);
+            for (auto r = rows.first; r < rows.second; ++i)
+            {
+               auto& para = _paragraphs[i];
+               bool  styled = synced && _lines[i].text == para.text;
+               for (auto j = r - para.first_row; j < para.rows.size() && r < rows.second; ++j, ++r)
+               {
+                  if (styled)
+                  {
+                     draw_row(ctx, { x, y }, para.rows[j], _lines[i]);
+                  }
+                  else
+                  {
+                     cnv.fill_style(_color);
+                     para.rows[j].draw({ x, y }, cnv);
+                  }
+                  y += line_height;
+               }
+            }
+         }
+      }
+      draw_caret(ctx);
+   }
+
+   void code_text_box::draw_row(
+      context const& ctx, point pos
+    , glyphs& row, line_info const& info
+   )
+   {
+      auto&       cnv = ctx.canvas;
+      auto        metrics = _layout.metrics();
+      char const* base = info.text->data();
+      char const* first = row.begin();
+      char const* last = row.end();
+
+      auto draw_run = [&](char const* f, char const* l, std::uint16_t style_id)
+      {
+         if (f >= l)
+            return;
+         if (style_id >= _styles.size())
+         {
+            cnv.fill_style(_color);
+            row.draw(pos, cnv, f, l);
+            return;
+         }
+
+         auto const& style = _styles[style_id];
+         cnv.fill_style(style.color_);
+         row.draw(pos, cnv, f, l);
+
+         // Faux bold: overstrike with a slight horizontal offset
+         if (style.bold)
+            row.draw({ pos.x + std::max(0.5f, metrics.ascent / 24), pos.y }, cnv, f, l);
+
+         float left, right;
+         if (style.underline && row.extent(f, l, left, right))
+         {
+            auto uy = pos.y + metrics.descent / 2;
+            cnv.stroke_style(style.color_);
+            cnv.line_width(std::max(1.0f, metrics.descent / 6));
+            cnv.move_to({ pos.x + left, uy });
+            cnv.line_to({ pos.x + right, uy });
+            cnv.stroke();
+         }
+      };
+
+      // The spans that overlap the row, with the gaps in between drawn
+      // plain (style 0).
+      auto row_first = std::uint32_t(first - base);
+      auto row_last = std::uint32_t(last - base);
+      auto span = std::partition_point(
+         info.spans.begin(), info.spans.end(),
+         [row_first](style_span const& s) { return s.last <= row_first; }
+      );
+
+      char const* p = first;
+      for (; span != info.spans.end() && span->first < row_last; ++span)
+      {
+         auto f = base + std::max(span->first, row_first);
+         auto l = base + std::min(span->last, row_last);
+         draw_run(p, f, 0);
+         draw_run(f, l, span->style);
+         p = l;
+      }
+      draw_run(p, last, 0);
+   }
+}}
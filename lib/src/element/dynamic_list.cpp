@@ -5,9 +5,213 @@
 =============================================================================*/
 #include <elements/element/dynamic_list.hpp>
 #include <elements/view.hpp>
+#include <asio.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace cycfi { namespace elements
 {
+   element_ptr cell_composer::placeholder(std::size_t /*index*/)
+   {
+      // An empty cell, shared by all placeholder rows
+      static auto empty = share(element{});
+      return empty;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // paged_cell_composer
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      asio::thread_pool& page_loader_pool()
+      {
+         static asio::thread_pool pool{ 2 };
+         return pool;
+      }
+   }
+
+   // The page cache is shared by the UI thread and the loaders, guarded by
+   // the mutex. Loaders skip pages that are no longer wanted by the time
+   // they get to run. The generation is bumped by invalidate, so that pages
+   // loaded before it are dropped.
+   struct paged_cell_composer::page_cache
+   {
+      struct entry
+      {
+         page_ptr             page;
+         std::uint64_t        used;
+      };
+
+      void                    insert(std::size_t key, page_ptr page);
+      bool                    wanted(std::size_t key) const
+                              {
+                                 return key >= wanted_first && key < wanted_last;
+                              }
+
+      std::size_t             capacity;
+      std::mutex              mutex;
+      std::unordered_map<std::size_t, entry> pages;
+      std::unordered_set<std::size_t> pending;
+      std::size_t             wanted_first = 0;
+      std::size_t             wanted_last = 0;
+      std::uint64_t           tick = 0;
+      std::uint64_t           generation = 0;
+   };
+
+   void paged_cell_composer::page_cache::insert(std::size_t key, page_ptr page)
+   {
+      pages[key] = { page, ++tick };
+
+      // Drop the least recently used pages that are out of view. There are
+      // only a few pages, so a linear search will do.
+      while (pages.size() > capacity)
+      {
+         auto lru = pages.end();
+         for (auto i = pages.begin(); i != pages.end(); ++i)
+         {
+            if (!wanted(i->first) && (lru == pages.end() || i->second.used < lru->second.used))
+               lru = i;
+         }
+         if (lru == pages.end())
+            break;   // All in view
+         pages.erase(lru);
+      }
+   }
+
+   paged_cell_composer::paged_cell_composer(std::size_t page_size, std::size_t max_pages)
+    : _page_size(std::max<std::size_t>(page_size, 1))
+    , _cache(std::make_unique<page_cache>())
+   {
+      _cache->capacity = std::max<std::size_t>(max_pages, 1);
+   }
+
+   paged_cell_composer::~paged_cell_composer()
+   {
+   }
+
+   paged_cell_composer::page_ptr paged_cell_composer::find_page(std::size_t index) const
+   {
+      std::lock_guard<std::mutex> lock(_cache->mutex);
+      auto i = _cache->pages.find(index / _page_size);
+      if (i == _cache->pages.end())
+         return {};
+      i->second.used = ++_cache->tick;
+      return i->second.page;
+   }
+
+   element_ptr paged_cell_composer::compose(std::size_t index)
+   {
+      if (auto page_ = find_page(index))
+         return compose_row(index, *page_, index % _page_size);
+      return placeholder(index);
+   }
+
+   bool paged_cell_composer::rebind(element& cell, std::size_t index)
+   {
+      if (auto page_ = find_page(index))
+         return rebind_row(cell, index, *page_, index % _page_size);
+      return false;
+   }
+
+   bool paged_cell_composer::rebind_row(
+      element& /*cell*/, std::size_t /*index*/, page const& /*page_*/, std::size_t /*offset*/)
+   {
+      return false;
+   }
+
+   bool paged_cell_composer::is_ready(std::size_t index) const
+   {
+      std::lock_guard<std::mutex> lock(_cache->mutex);
+      return _cache->pages.count(index / _page_size) != 0;
+   }
+
+   void paged_cell_composer::invalidate()
+   {
+      std::lock_guard<std::mutex> lock(_cache->mutex);
+      _cache->pages.clear();
+      _cache->pending.clear();
+      ++_cache->generation;
+   }
+
+   void paged_cell_composer::request(std::size_t first, std::size_t last, ready_function const& ready)
+   {
+      auto size_ = size();
+      last = std::min(last, size_);
+      if (first >= last)
+         return;
+
+      std::weak_ptr<cell_composer> weak_self = weak_from_this();
+      auto page_size = _page_size;
+      auto cache = _cache.get();
+
+      std::lock_guard<std::mutex> lock(cache->mutex);
+      cache->wanted_first = first / page_size;
+      cache->wanted_last = (last + page_size - 1) / page_size;
+
+      for (auto key = cache->wanted_first; key != cache->wanted_last; ++key)
+      {
+         if (cache->pages.count(key) || cache->pending.count(key))
+            continue;
+         cache->pending.insert(key);
+
+         auto page_first = key * page_size;
+         auto page_last = std::min(page_first + page_size, size_);
+         auto generation = cache->generation;
+
+         asio::post(page_loader_pool(),
+            [weak_self, ready, key, page_first, page_last, generation]()
+            {
+               // Hold on to the composer only while loading. If it is
+               // gone, so is the cache.
+               auto self = weak_self.lock();
+               if (!self)
+                  return;
+               auto& this_ = static_cast<paged_cell_composer&>(*self);
+               auto& cache = *this_._cache;
+               {
+                  std::lock_guard<std::mutex> lock(cache.mutex);
+                  if (cache.generation != generation)
+                     return;
+                  if (!cache.wanted(key))
+                  {
+                     cache.pending.erase(key);
+                     return;
+                  }
+               }
+
+               page_ptr page_;
+               try
+               {
+                  page_ = this_.load_page(page_first, page_last);
+               }
+               catch (std::exception const&)
+               {
+                  // Leave the rows as placeholders. The page will be
+                  // requested again when the view changes.
+               }
+
+               {
+                  std::lock_guard<std::mutex> lock(cache.mutex);
+                  if (cache.generation != generation)
+                     return;
+                  cache.pending.erase(key);
+                  if (!page_)
+                     return;
+                  cache.insert(key, page_);
+               }
+               if (ready)
+                  ready(page_first, page_last);
+            }
+         );
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // dynamic_list
+   ////////////////////////////////////////////////////////////////////////////
    view_limits dynamic_list::limits(basic_context const& ctx) const
    {
       if (_composer)
@@ -17,9 +221,10 @@ namespace cycfi { namespace elements
          auto w_limits = _composer->width_limits(ctx);
          if (_composer->size())
          {
+            auto height = float(_heights.total());
             return {
-               { w_limits.min, float(_height) }
-             , { w_limits.max, float(_height) }
+               { w_limits.min, height }
+             , { w_limits.max, height }
             };
          }
       }
@@ -36,27 +241,63 @@ namespace cycfi { namespace elements
       if (!intersects(ctx.bounds, clip_extent))
          return;
 
-      auto it = std::lower_bound(_rows.begin(), _rows.end(),
-         clip_extent.top-top,
-         [](auto const& row, double pivot)
+      if (_update_request)
+         update(ctx);
+
+      // Find the rows within the visible bounds of the view
+      std::size_t new_start = _heights.find_lower(clip_extent.top-top);
+      std::size_t new_end = std::min(_heights.find_upper(clip_extent.bottom-top) + 1, _rows.size());
+      new_start = std::min(new_start, new_end);
+
+      // Release the rows that left the window first, so that their cells
+      // can be reused for the rows that entered it. While rows are shown as
+      // placeholders, ask for them again even if the window did not change
+      // (their pages may have failed to load, or been invalidated).
+      bool moved = new_start != _previous_window_start || new_end != _previous_window_end;
+      if (moved || _placeholders)
+         request(ctx, new_start, new_end);
+      if (moved)
+      {
+         auto end = std::min(_previous_window_end, _rows.size());
+         for (auto i = _previous_window_start; i < end; ++i)
          {
-            return (row.pos + row.height) < pivot;
+            if (i < new_start || i >= new_end)
+               release(i);
          }
-      );
+      }
 
-      // Draw the rows within the visible bounds of the view
-      std::size_t new_start = it - _rows.begin();
-      for (; it != _rows.end(); ++it)
+      // Draw the rows
+      _placeholders = false;
+      auto pos = _heights.prefix(new_start);
+      for (auto i = new_start; i != new_end; pos += _heights[i++])
       {
-         auto& row = *it;
+         auto& row = _rows[i];
          context rctx { ctx, row.elem_ptr.get(), ctx.bounds };
-         rctx.bounds.top = top + row.pos;
-         rctx.bounds.height(row.height);
+         rctx.bounds.top = top + pos;
+         rctx.bounds.height(_heights[i]);
          if (intersects(clip_extent, rctx.bounds))
          {
+            // Swap in the real cell when the row's data is ready. Ask
+            // only for rows without a real cell.
+            bool ready = (row.placeholder || !row.elem_ptr)? _composer->is_ready(i) : true;
+            if (row.placeholder && ready)
+            {
+               row.elem_ptr.reset();
+               row.placeholder = false;
+            }
+
             if (!row.elem_ptr)
             {
-               row.elem_ptr = _composer->compose(it-_rows.begin());
+               if (ready)
+               {
+                  row.elem_ptr = compose(i);
+               }
+               else
+               {
+                  row.elem_ptr = _composer->placeholder(i);
+                  row.placeholder = true;
+               }
+               rctx.element = row.elem_ptr.get();
                row.elem_ptr->layout(rctx);
                row.layout_id = _layout_id;
             }
@@ -66,29 +307,87 @@ namespace cycfi { namespace elements
                row.layout_id = _layout_id;
             }
             row.elem_ptr->draw(rctx);
+            _placeholders = _placeholders || row.placeholder;
          }
-         if (rctx.bounds.top > clip_extent.bottom)
-            break;
       }
-      std::size_t new_end = it - _rows.begin();
 
-      // Cleanup old rows
-      if (new_start != _previous_window_start || new_end != _previous_window_end)
+      _previous_window_start = new_start;
+      _previous_window_end = new_end;
+      _previous_size.x = ctx.bounds.width();
+      _previous_size.y = ctx.bounds.height();
+   }
+
+   element_ptr dynamic_list::compose(std::size_t index)
+   {
+      // Rebind a pooled cell if we can, most recently released first.
+      // Cells that can't show the row stay in the pool for rows that they
+      // can show.
+      for (auto i = _pool.size(); i-- != 0;)
       {
-         for (auto i = _previous_window_start; i != _previous_window_end; ++i)
+         if (_composer->rebind(*_pool[i], index))
          {
-            if (i < new_start || i >= new_end)
-            {
-               _rows[i].elem_ptr.reset();
-               _rows[i].layout_id = -1;
-            }
+            auto cell = std::move(_pool[i]);
+            _pool[i] = std::move(_pool.back());
+            _pool.pop_back();
+            return cell;
          }
       }
+      return _composer->compose(index);
+   }
 
-      _previous_window_start = new_start;
-      _previous_window_end = new_end;
-      _previous_size.x = ctx.bounds.width();
-      _previous_size.y = ctx.bounds.height();
+   void dynamic_list::release(std::size_t index)
+   {
+      auto& row = _rows[index];
+      if (row.elem_ptr && !row.placeholder
+         && _composer->recycles() && _pool.size() < _pool_size)
+      {
+         _pool.push_back(std::move(row.elem_ptr));
+      }
+      row.elem_ptr.reset();
+      row.layout_id = -1;
+      row.placeholder = false;
+   }
+
+   void dynamic_list::request(context const& ctx, std::size_t first, std::size_t last)
+   {
+      // Ask for the rows in view, and as many again above and below them.
+      // The ready function posts a refresh to the UI thread, where the
+      // placeholders are swapped for real cells as they are drawn. It is
+      // called from the loader threads, which may outlive the view, so it
+      // posts through the view's handle.
+      if (_ready_view != &ctx.view)
+      {
+         _ready_view = &ctx.view;
+         std::weak_ptr<element> weak_self = weak_from_this();
+         auto& view_ = ctx.view;
+         _ready =
+            [weak_self, handle = view_.handle(), &view_](std::size_t /*first*/, std::size_t /*last*/)
+            {
+               // This runs on the view's own io, so the view is there
+               handle.post(
+                  [weak_self, &view_]()
+                  {
+                     if (auto self = weak_self.lock())
+                        view_.refresh(*self);
+                  }
+               );
+            };
+      }
+
+      auto span = last - first;
+      _composer->request(
+         first - std::min(first, span)
+       , std::min(last + span, _rows.size())
+       , _ready
+      );
+   }
+
+   void dynamic_list::pool_size(std::size_t n)
+   {
+      _pool_size = n;
+      if (_pool.size() > n)
+         _pool.resize(n);
+      _pool.reserve(n);
    }
 
    void dynamic_list::layout(context const& ctx)
@@ -104,30 +403,151 @@ namespace cycfi { namespace elements
 
    void dynamic_list::update()
    {
+      if (_composer)
+      {
+         for (auto i = _previous_window_start; i < _previous_window_end && i < _rows.size(); ++i)
+            release(i);
+      }
+      _previous_window_start = _previous_window_end = 0;
       _update_request = true;
       _rows.clear();
-      _height = 0;
+      _heights.clear();
+      _pending.clear();
    }
 
    void dynamic_list::update(basic_context const& ctx) const
    {
       if (_composer)
       {
-         if (auto size = _composer->size())
+         auto size = _composer->size();
+         if (_rows.size() != size)
          {
-            double y = 0;
-            _rows.reserve(_composer->size());
+            // Measure all the rows
+            _rows.clear();
+            _rows.resize(size);
+            _heights.clear();
+            _heights.reserve(size);
             for (std::size_t i = 0; i != size; ++i)
-            {
-               auto line_height = _composer->line_height(i, ctx);
-               _rows.push_back({ y, line_height, nullptr });
-               y += line_height;
-            }
-            _height = y;
+               _heights.push_back(_composer->line_height(i, ctx));
+            ++_layout_id;
+         }
+         else
+         {
+            // Measure only the rows inserted or resized since
+            for (auto i : _pending)
+               _heights.set(i, _composer->line_height(i, ctx));
          }
       }
-      ++_layout_id;
+      _pending.clear();
       _update_request = false;
    }
+
+   void dynamic_list::insert(std::size_t index, std::size_t count)
+   {
+      _update_request = true;
+      if (_rows.empty() || count == 0)
+         return;  // Everything gets measured
+
+      index = std::min(index, _rows.size());
+      _rows.insert(_rows.begin() + index, count, row_info{});
+      _heights.insert(index, count, 0);
+
+      for (auto& i : _pending)
+      {
+         if (i >= index)
+            i += count;
+      }
+      for (auto i = index; i != index + count; ++i)
+         _pending.push_back(i);
+
+      // Shift the window along with the cells in it
+      if (_previous_window_start >= index)
+         _previous_window_start += count;
+      if (_previous_window_end > index)
+         _previous_window_end += count;
+   }
+
+   void dynamic_list::erase(std::size_t index, std::size_t count)
+   {
+      if (index >= _rows.size())
+         return;
+
+      count = std::min(count, _rows.size() - index);
+      auto last = index + count;
+      for (auto i = index; i != last; ++i)
+         release(i);
+      _rows.erase(_rows.begin() + index, _rows.begin() + last);
+      _heights.erase(index, count);
+
+      _pending.erase(
+         std::remove_if(_pending.begin(), _pending.end(),
+            [=](std::size_t i) { return i >= index && i < last; }),
+         _pending.end()
+      );
+      for (auto& i : _pending)
+      {
+         if (i >= last)
+            i -= count;
+      }
+
+      auto shift = [=](std::size_t i)
+      {
+         return (i <= index)? i : (i < index + count)? index : i - count;
+      };
+      _previous_window_start = shift(_previous_window_start);
+      _previous_window_end = shift(_previous_window_end);
+      _update_request = true;
+   }
+
+   void dynamic_list::move(std::size_t from, std::size_t to)
+   {
+      if (from == to || from >= _rows.size() || to >= _rows.size())
+         return;
+
+      if (from < to)
+         std::rotate(_rows.begin() + from, _rows.begin() + from + 1, _rows.begin() + to + 1);
+      else
+         std::rotate(_rows.begin() + to, _rows.begin() + from, _rows.begin() + from + 1);
+      _heights.move(from, to);
+
+      for (auto& i : _pending)
+      {
+         if (i == from)
+            i = to;
+         else if (from < to && i > from && i <= to)
+            --i;
+         else if (to < from && i >= to && i < from)
+            ++i;
+      }
+
+      // Widen the window to cover where the cells in it went
+      if (_previous_window_start != _previous_window_end)
+      {
+         _previous_window_start = std::min({ _previous_window_start, from, to });
+         _previous_window_end = std::max({ _previous_window_end, from + 1, to + 1 });
+      }
+      _update_request = true;
+   }
+
+   void dynamic_list::recompose(std::size_t index)
+   {
+      if (index < _rows.size())
+         release(index);
+   }
+
+   std::size_t dynamic_list::row_at(double pos) const
+   {
+      auto i = _heights.find_upper(pos);
+      return (pos >= 0 && i < _rows.size())? i : _rows.size();
+   }
+
+   void dynamic_list::resize_row(std::size_t index)
+   {
+      if (index >= _rows.size())
+         return;
+      _rows[index].layout_id = -1;
+      _pending.push_back(index);
+      _update_request = true;
+   }
 }}
 
@@ -0,0 +1,215 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/dynamic_table.hpp>
+#include <elements/support/canvas.hpp>
+#include <elements/support/context.hpp>
+#include <algorithm>
+
+namespace cycfi { namespace elements
+{
+   dynamic_table::dynamic_table(composer_ptr composer)
+    : _composer(composer)
+   {
+      _pool.reserve(_pool_size);
+   }
+
+   view_limits dynamic_table::limits(basic_context const& ctx) const
+   {
+      if (_composer)
+      {
+         if (_update_request)
+            update(ctx);
+         point size = { float(_col_widths.total()), float(_row_heights.total()) };
+         return { size, size };
+      }
+      return {{ 0, 0 }, { 0, 0 }};
+   }
+
+   void dynamic_table::draw(context const& ctx)
+   {
+      auto& cnv = ctx.canvas;
+      auto  visible = min(ctx.bounds, cnv.clip_extent());
+      if (!_composer || visible.top >= visible.bottom || visible.left >= visible.right)
+         return;
+
+      if (_update_request)
+         update(ctx);
+
+      auto  num_rows = _row_heights.size();
+      auto  num_cols = _col_widths.size();
+      auto  header_rows = std::min(_composer->header_rows(), num_rows);
+      auto  header_cols = std::min(_composer->header_cols(), num_cols);
+      auto  header_height = float(_row_heights.prefix(header_rows));
+      auto  header_width = float(_col_widths.prefix(header_cols));
+
+      // The headers stick to the top and left of the visible area. The
+      // body rows and columns in view are the ones not hidden behind them.
+      point sticky = { std::max(ctx.bounds.left, visible.left), std::max(ctx.bounds.top, visible.top) };
+      point origin = { ctx.bounds.left, ctx.bounds.top };
+
+      auto find = [](extents_tree const& tree, std::size_t first, float from, float to)
+      {
+         auto last = std::min(tree.find_upper(to) + 1, tree.size());
+         return span{ std::min(std::max(first, tree.find_lower(from)), last), last };
+      };
+
+      span  body_rows = find(_row_heights, header_rows,
+               sticky.y + header_height - origin.y, visible.bottom - origin.y);
+      span  body_cols = find(_col_widths, header_cols,
+               sticky.x + header_width - origin.x, visible.right - origin.x);
+      span  head_rows = { 0, header_rows };
+      span  head_cols = { 0, header_cols };
+
+      rect  body = { sticky.x + header_width, sticky.y + header_height, visible.right, visible.bottom };
+      rect  top = { body.left, sticky.y, body.right, body.top };
+      rect  left = { sticky.x, body.top, body.left, body.bottom };
+      rect  corner = { sticky.x, sticky.y, body.left, body.top };
+
+      ++_frame;
+      draw_cells(ctx, body, body_rows, body_cols, origin);
+      draw_cells(ctx, top, head_rows, body_cols, { origin.x, sticky.y });
+      draw_cells(ctx, left, body_rows, head_cols, { sticky.x, origin.y });
+      draw_cells(ctx, corner, head_rows, head_cols, sticky);
+
+      // Release the cells that are no longer in view
+      for (auto i = _cells.begin(); i != _cells.end();)
+      {
+         if (i->second.frame != _frame)
+         {
+            release(i->second);
+            i = _cells.erase(i);
+         }
+         else
+         {
+            ++i;
+         }
+      }
+
+      _previous_size.x = ctx.bounds.width();
+      _previous_size.y = ctx.bounds.height();
+   }
+
+   void dynamic_table::draw_cells(
+      context const& ctx, rect region
+    , span rows, span cols, point origin
+   )
+   {
+      if (rows.first >= rows.second || cols.first >= cols.second)
+         return;
+      region = min(region, ctx.canvas.clip_extent());
+      if (region.left >= region.right || region.top >= region.bottom)
+         return;
+
+      auto& cnv = ctx.canvas;
+      auto  state = cnv.new_state();
+      cnv.rect(region);
+      cnv.clip();
+
+      auto  num_cols = _col_widths.size();
+      auto  left = origin.x + float(_col_widths.prefix(cols.first));
+      auto  y = origin.y + float(_row_heights.prefix(rows.first));
+      for (auto r = rows.first; r != rows.second; ++r)
+      {
+         auto height = float(_row_heights[r]);
+         auto x = left;
+         for (auto c = cols.first; c != cols.second; ++c)
+         {
+            auto  width = float(_col_widths[c]);
+            auto& cell = _cells[std::uint64_t(r) * num_cols + c];
+            cell.frame = _frame;
+
+            context cctx { ctx, cell.elem_ptr.get(), rect{ x, y, x + width, y + height } };
+            if (!cell.elem_ptr)
+            {
+               cell.elem_ptr = compose(r, c);
+               cctx.element = cell.elem_ptr.get();
+               cell.elem_ptr->layout(cctx);
+               cell.layout_id = _layout_id;
+            }
+            else if (cell.layout_id != _layout_id)
+            {
+               cell.elem_ptr->layout(cctx);
+               cell.layout_id = _layout_id;
+            }
+            cell.elem_ptr->draw(cctx);
+            x += width;
+         }
+         y += height;
+      }
+   }
+
+   element_ptr dynamic_table::compose(std::size_t row, std::size_t col)
+   {
+      // Rebind a pooled cell if we can, most recently released first.
+      // Cells that can't show this one stay in the pool for those that
+      // they can show.
+      for (auto i = _pool.size(); i-- != 0;)
+      {
+         if (_composer->rebind(*_pool[i], row, col))
+         {
+            auto cell = std::move(_pool[i]);
+            _pool[i] = std::move(_pool.back());
+            _pool.pop_back();
+            return cell;
+         }
+      }
+      return _composer->compose(row, col);
+   }
+
+   void dynamic_table::release(cell_info& cell)
+   {
+      if (cell.elem_ptr && _composer->recycles() && _pool.size() < _pool_size)
+         _pool.push_back(std::move(cell.elem_ptr));
+      cell.elem_ptr.reset();
+      cell.layout_id = -1;
+   }
+
+   void dynamic_table::pool_size(std::size_t n)
+   {
+      _pool_size = n;
+      if (_pool.size() > n)
+         _pool.resize(n);
+      _pool.reserve(n);
+   }
+
+   void dynamic_table::layout(context const& ctx)
+   {
+      if (_previous_size.x != ctx.bounds.width() ||
+         _previous_size.y != ctx.bounds.height())
+      {
+         _previous_size.x = ctx.bounds.width();
+         _previous_size.y = ctx.bounds.height();
+         ++_layout_id;
+      }
+   }
+
+   void dynamic_table::update()
+   {
+      for (auto& cell : _cells)
+         release(cell.second);
+      _cells.clear();
+      _update_request = true;
+   }
+
+   void dynamic_table::update(basic_context const& ctx) const
+   {
+      _row_heights.clear();
+      _col_widths.clear();
+      if (_composer)
+      {
+         auto num_rows = _composer->num_rows();
+         auto num_cols = _composer->num_cols();
+         _row_heights.reserve(num_rows);
+         _col_widths.reserve(num_cols);
+         for (std::size_t i = 0; i != num_rows; ++i)
+            _row_heights.push_back(_composer->row_height(i, ctx));
+         for (std::size_t i = 0; i != num_cols; ++i)
+            _col_widths.push_back(_composer->col_width(i, ctx));
+      }
+      ++_layout_id;
+      _update_request = false;
+   }
+}}
@@ -0,0 +1,260 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/dynamic_tree.hpp>
+#include <elements/support/context.hpp>
+#include <elements/view.hpp>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The tree composer presents the flattened rows to the dynamic_list.
+   ////////////////////////////////////////////////////////////////////////////
+   class dynamic_tree::tree_composer : public cell_composer
+   {
+   public:
+
+      struct row_info
+      {
+         node_id              node;
+         std::uint32_t        depth;
+         bool                 expanded;
+      };
+
+                              tree_composer(provider_ptr provider_)
+                               : provider(std::move(provider_))
+                              {}
+
+      std::size_t             size() const override;
+      element_ptr             compose(std::size_t index) override;
+      limits                  width_limits(basic_context const& ctx) const override;
+      float                   line_height(std::size_t index, basic_context const& ctx) const override;
+      bool                    recycles() const override;
+      bool                    rebind(element& cell, std::size_t index) override;
+
+      void                    reload();
+      std::vector<node_id> const& children(node_id node);
+      void                    flatten(node_id node, std::uint32_t depth, std::vector<row_info>& out);
+      std::size_t             subtree_end(std::size_t row) const;
+
+      provider_ptr            provider;
+      std::vector<row_info>   rows;
+      std::unordered_map<node_id, std::vector<node_id>> loaded;
+      std::unordered_set<node_id> expanded;
+   };
+
+   std::size_t dynamic_tree::tree_composer::size() const
+   {
+      return rows.size();
+   }
+
+   element_ptr dynamic_tree::tree_composer::compose(std::size_t index)
+   {
+      auto const& row = rows[index];
+      return provider->compose(row.node, row.depth, row.expanded);
+   }
+
+   cell_composer::limits dynamic_tree::tree_composer::width_limits(basic_context const& ctx) const
+   {
+      return provider->width_limits(ctx);
+   }
+
+   float dynamic_tree::tree_composer::line_height(std::size_t index, basic_context const& ctx) const
+   {
+      return provider->line_height(rows[index].node, ctx);
+   }
+
+   bool dynamic_tree::tree_composer::recycles() const
+   {
+      return provider->recycles();
+   }
+
+   bool dynamic_tree::tree_composer::rebind(element& cell, std::size_t index)
+   {
+      auto const& row = rows[index];
+      return provider->rebind(cell, row.node, row.depth, row.expanded);
+   }
+
+   void dynamic_tree::tree_composer::reload()
+   {
+      rows.clear();
+      loaded.clear();
+      flatten(provider->root(), 0, rows);
+   }
+
+   std::vector<tree_provider::node_id> const&
+   dynamic_tree::tree_composer::children(node_id node)
+   {
+      // Load the children of a node only once, when first needed. The
+      // references stay valid as the map grows.
+      auto i = loaded.find(node);
+      if (i == loaded.end())
+      {
+         i = loaded.emplace(node, std::vector<node_id>{}).first;
+         if (provider->has_children(node))
+            provider->load_children(node, i->second);
+      }
+      return i->second;
+   }
+
+   void dynamic_tree::tree_composer::flatten(
+      node_id node, std::uint32_t depth, std::vector<row_info>& out)
+   {
+      // Append the rows of the subtree below node, descending into the
+      // nodes that are expanded.
+      for (auto child : children(node))
+      {
+         bool is_expanded = expanded.count(child) != 0;
+         out.push_back({ child, depth, is_expanded });
+         if (is_expanded)
+            flatten(child, depth + 1, out);
+      }
+   }
+
+   std::size_t dynamic_tree::tree_composer::subtree_end(std::size_t row) const
+   {
+      auto depth = rows[row].depth;
+      auto end = row + 1;
+      while (end < rows.size() && rows[end].depth > depth)
+         ++end;
+      return end;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // dynamic_tree
+   ////////////////////////////////////////////////////////////////////////////
+   dynamic_tree::dynamic_tree(provider_ptr provider, float indent)
+    : dynamic_tree(std::make_shared<tree_composer>(std::move(provider)), indent)
+   {}
+
+   dynamic_tree::dynamic_tree(tree_composer_ptr tree, float indent)
+    : dynamic_list(tree)
+    , _tree(tree)
+    , _indent(indent)
+   {
+      _tree->reload();
+   }
+
+   bool dynamic_tree::wants_control() const
+   {
+      return true;
+   }
+
+   bool dynamic_tree::click(context const& ctx, mouse_button btn)
+   {
+      if (!btn.down || btn.state != mouse_button::left)
+         return false;
+
+      auto row = row_at(btn.pos.y - ctx.bounds.top);
+      if (row >= num_rows())
+         return false;
+
+      // A single click in the indent column, or a double click elsewhere.
+      // The first click of a double click in the indent column already
+      // toggled the node; the second must not toggle it back.
+      auto x = btn.pos.x - ctx.bounds.left;
+      auto left = depth(row) * _indent;
+      bool in_indent = x >= left && x < left + _indent;
+      if (btn.num_clicks != (in_indent? 1 : 2))
+         return false;
+      if (!_tree->provider->has_children(node(row)))
+         return false;
+
+      toggle(row);
+      ctx.view.layout(*this);
+      return true;
+   }
+
+   std::size_t dynamic_tree::num_rows() const
+   {
+      return _tree->rows.size();
+   }
+
+   dynamic_tree::node_id dynamic_tree::node(std::size_t row) const
+   {
+      return _tree->rows[row].node;
+   }
+
+   std::size_t dynamic_tree::depth(std::size_t row) const
+   {
+      return _tree->rows[row].depth;
+   }
+
+   bool dynamic_tree::is_expanded(std::size_t row) const
+   {
+      return _tree->rows[row].expanded;
+   }
+
+   std::size_t dynamic_tree::find_row(node_id node) const
+   {
+      // A linear search through the visible rows
+      auto const& rows = _tree->rows;
+      for (std::size_t i = 0; i != rows.size(); ++i)
+      {
+         if (rows[i].node == node)
+            return i;
+      }
+      return rows.size();
+   }
+
+   void dynamic_tree::expand(std::size_t row)
+   {
+      if (row >= num_rows())
+         return;
+
+      auto& info = _tree->rows[row];
+      if (info.expanded || !_tree->provider->has_children(info.node))
+         return;
+
+      info.expanded = true;
+      _tree->expanded.insert(info.node);
+
+      // Insert the rows of the subtree, and only these
+      std::vector<tree_composer::row_info> subtree;
+      _tree->flatten(info.node, info.depth + 1, subtree);
+      auto& rows = _tree->rows;
+      rows.insert(rows.begin() + row + 1, subtree.begin(), subtree.end());
+
+      dynamic_list::insert(row + 1, subtree.size());
+      recompose(row);
+   }
+
+   void dynamic_tree::collapse(std::size_t row)
+   {
+      if (row >= num_rows())
+         return;
+
+      auto& info = _tree->rows[row];
+      if (!info.expanded)
+         return;
+
+      info.expanded = false;
+      _tree->expanded.erase(info.node);
+
+      // Erase the rows of the subtree, and only these
+      auto  end = _tree->subtree_end(row);
+      auto& rows = _tree->rows;
+      rows.erase(rows.begin() + row + 1, rows.begin() + end);
+
+      dynamic_list::erase(row + 1, end - (row + 1));
+      recompose(row);
+   }
+
+   void dynamic_tree::toggle(std::size_t row)
+   {
+      if (is_expanded(row))
+         collapse(row);
+      else
+         expand(row);
+   }
+
+   void dynamic_tree::update()
+   {
+      _tree->reload();
+      dynamic_list::update();
+   }
+}}
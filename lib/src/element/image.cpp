@@ -6,7 +6,9 @@
 #include <elements/element/image.hpp>
 #include <elements/support.hpp>
 #include <elements/support/context.hpp>
+#include <cairo.h>
 #include <algorithm>
+#include <cmath>
 
 namespace cycfi { namespace elements
 {
@@ -97,12 +99,84 @@ namespace cycfi { namespace elements
       }
    }
 
+   namespace
+   {
+      // The device (target surface pixel) scale of cnv, if its transform
+      // is a uniform, axis-aligned scale, else 0. The transform from user
+      // to device space is then x * scale + offset.
+      float device_scale(canvas& cnv, point& offset)
+      {
+         auto& cr = cnv.cairo_context();
+         cairo_matrix_t mat;
+         cairo_get_matrix(&cr, &mat);
+
+         double tsx, tsy, tox, toy;
+         auto target = cairo_get_group_target(&cr);
+         cairo_surface_get_device_scale(target, &tsx, &tsy);
+         cairo_surface_get_device_offset(target, &tox, &toy);
+
+         auto sx = mat.xx * tsx;
+         auto sy = mat.yy * tsy;
+         if (mat.xy != 0 || mat.yx != 0 || sx <= 0 || std::abs(sx - sy) > 1e-4)
+            return 0;
+         offset = { float(mat.x0 * tsx + tox), float(mat.y0 * tsy + toy) };
+         return float(sx);
+      }
+   }
+
+   void basic_gizmo::draw(context const& ctx)
+   {
+      if (ctx.bounds.width() <= 0 || ctx.bounds.height() <= 0)
+         return;
+
+      // Draw the patches directly if the canvas is rotated or skewed.
+      // The cache would have to be resampled.
+      point offset;
+      float sc = device_scale(ctx.canvas, offset);
+      if (sc <= 0)
+      {
+         draw_patches(ctx.canvas, ctx.bounds);
+         return;
+      }
+
+      // Snap the destination to device pixels and render the cache at
+      // exactly that many pixels, so that it is blitted 1:1, without
+      // filtering.
+      auto  snap = [&](float pos, float offset_)
+      {
+         return (std::round(pos * sc + offset_) - offset_) / sc;
+      };
+      rect  dest = {
+         snap(ctx.bounds.left, offset.x), snap(ctx.bounds.top, offset.y)
+       , snap(ctx.bounds.right, offset.x), snap(ctx.bounds.bottom, offset.y)
+      };
+      point pixels = {
+         std::round(dest.width() * sc), std::round(dest.height() * sc)
+      };
+      if (pixels.x <= 0 || pixels.y <= 0)
+         return;
+
+      if (!_cache || _cache_size != pixels || _cache_scale != sc)
+      {
+         auto  format = pixmap().format();
+         _cache = std::make_shared<elements::pixmap>(pixels, 1/sc, format);
+         _cache_size = pixels;
+         _cache_scale = sc;
+
+         pixmap_context pm_ctx{ *_cache };
+         canvas cache_cnv{ *pm_ctx.context() };
+         draw_patches(cache_cnv, { 0, 0, dest.width(), dest.height() });
+      }
+
+      ctx.canvas.draw(*_cache, { 0, 0, dest.width(), dest.height() }, dest);
+   }
+
    gizmo::gizmo(char const* filename, float scale)
-    : image(filename, scale)
+    : basic_gizmo(filename, scale)
    {}
 
    gizmo::gizmo(pixmap_ptr pixmap_)
-    : image(pixmap_)
+    : basic_gizmo(pixmap_)
    {}
 
    view_limits gizmo::limits(basic_context const& /* ctx */) const
@@ -111,7 +185,7 @@ namespace cycfi { namespace elements
       return { { size_.x, size_.y }, { full_extent, full_extent } };
    }
 
-   void gizmo::draw(context const& ctx)
+   void gizmo::draw_patches(canvas& cnv, rect bounds) const
    {
       rect  src[9];
       rect  dest[9];
@@ -119,18 +193,18 @@ namespace cycfi { namespace elements
       rect  src_bounds{ 0, 0, size_.x, size_.y };
 
       gizmo_parts(src_bounds, src_bounds, src);
-      gizmo_parts(src_bounds, ctx.bounds, dest);
+      gizmo_parts(src_bounds, bounds, dest);
 
       for (int i = 0; i < 9; i++)
-         ctx.canvas.draw(pixmap(), src[i], dest[i]);
+         cnv.draw(pixmap(), src[i], dest[i]);
    }
 
    hgizmo::hgizmo(char const* filename, float scale)
-    : image(filename, scale)
+    : basic_gizmo(filename, scale)
    {}
 
    hgizmo::hgizmo(pixmap_ptr pixmap_)
-    : image(pixmap_)
+    : basic_gizmo(pixmap_)
    {}
 
    view_limits hgizmo::limits(basic_context const& /* ctx */) const
@@ -139,7 +213,7 @@ namespace cycfi { namespace elements
       return { { size_.x, size_.y }, { size_.y, full_extent } };
    }
 
-   void hgizmo::draw(context const& ctx)
+   void hgizmo::draw_patches(canvas& cnv, rect bounds) const
    {
       rect  src[3];
       rect  dest[3];
@@ -147,18 +221,18 @@ namespace cycfi { namespace elements
       rect  src_bounds{ 0, 0, size_.x, size_.y };
 
       hgizmo_parts(src_bounds, src_bounds, src);
-      hgizmo_parts(src_bounds, ctx.bounds, dest);
-      ctx.canvas.draw(pixmap(), src[0], dest[0]);
-      ctx.canvas.draw(pixmap(), src[1], dest[1]);
-      ctx.canvas.draw(pixmap(), src[2], dest[2]);
+      hgizmo_parts(src_bounds, bounds, dest);
+      cnv.draw(pixmap(), src[0], dest[0]);
+      cnv.draw(pixmap(), src[1], dest[1]);
+      cnv.draw(pixmap(), src[2], dest[2]);
    }
 
    vgizmo::vgizmo(char const* filename, float scale)
-    : image(filename, scale)
+    : basic_gizmo(filename, scale)
    {}
 
    vgizmo::vgizmo(pixmap_ptr pixmap_)
-    : image(pixmap_)
+    : basic_gizmo(pixmap_)
    {}
 
    view_limits vgizmo::limits(basic_context const& /* ctx */) const
@@ -167,7 +241,7 @@ namespace cycfi { namespace elements
       return { { size_.x, size_.y }, { size_.x, full_extent } };
    }
 
-   void vgizmo::draw(context const& ctx)
+   void vgizmo::draw_patches(canvas& cnv, rect bounds) const
    {
       rect  src[3];
       rect  dest[3];
@@ -175,10 +249,10 @@ namespace cycfi { namespace elements
       rect  src_bounds{ 0, 0, size_.x, size_.y };
 
       vgizmo_parts(src_bounds, src_bounds, src);
-      vgizmo_parts(src_bounds, ctx.bounds, dest);
-      ctx.canvas.draw(pixmap(), src[0], dest[0]);
-      ctx.canvas.draw(pixmap(), src[1], dest[1]);
-      ctx.canvas.draw(pixmap(), src[2], dest[2]);
+      vgizmo_parts(src_bounds, bounds, dest);
+      cnv.draw(pixmap(), src[0], dest[0]);
+      cnv.draw(pixmap(), src[1], dest[1]);
+      cnv.draw(pixmap(), src[2], dest[2]);
    }
 
    basic_sprite::basic_sprite(char const* filename, float height, float scale)
@@ -0,0 +1,258 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/log_view.hpp>
+#include <elements/element/port.hpp>
+#include <elements/support/context.hpp>
+#include <elements/view.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // A lock-free multiple-producer, single-consumer queue of lines. The
+   // producers push onto a singly linked stack. The consumer (the UI
+   // thread) takes the whole stack at once and reverses it. The view is
+   // posted a drain only for the first line of a batch.
+   ////////////////////////////////////////////////////////////////////////////
+   struct log_view::queue
+   {
+      struct node
+      {
+         std::string          text;
+         node*                next;
+      };
+
+                              queue(log_view* owner_) : owner(owner_) {}
+                              ~queue();
+
+      void                    push(string_view text);
+      node*                   take();
+
+      log_view*               owner;      // Re-pointed when the log view is moved
+      std::atomic<node*>      head{ nullptr };
+      std::atomic<view*>      view_{ nullptr };
+      std::atomic<bool>       posted{ false };
+   };
+
+   log_view::queue::~queue()
+   {
+      for (auto n = head.exchange(nullptr); n;)
+      {
+         auto next = n->next;
+         delete n;
+         n = next;
+      }
+   }
+
+   void log_view::queue::push(string_view text)
+   {
+      auto n = new node{ std::string{ text }, head.load(std::memory_order_relaxed) };
+      while (!head.compare_exchange_weak(
+         n->next, n, std::memory_order_release, std::memory_order_relaxed))
+         ;
+   }
+
+   log_view::queue::node* log_view::queue::take()
+   {
+      // Reverse the stack to get the lines in the order they were pushed
+      node* n = head.exchange(nullptr, std::memory_order_acquire);
+      node* result = nullptr;
+      while (n)
+      {
+         auto next = n->next;
+         n->next = result;
+         result = n;
+         n = next;
+      }
+      return result;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // log_view implementation
+   ////////////////////////////////////////////////////////////////////////////
+   log_view::log_view(std::size_t max_lines, font font_, float size, color color_)
+    : _max_lines(std::max<std::size_t>(max_lines, 1))
+    , _layout(string_view{ "" }, font_, size)
+    , _color(color_)
+    , _queue(std::make_shared<queue>(this))
+   {}
+
+   log_view::log_view(log_view&& rhs)
+    : element(std::move(rhs))
+    , _max_lines(rhs._max_lines)
+    , _layout(std::move(rhs._layout))
+    , _color(rhs._color)
+    , _lines(std::move(rhs._lines))
+    , _queue(std::move(rhs._queue))
+    , _at_tail(rhs._at_tail)
+    , _scroll_to_tail(rhs._scroll_to_tail)
+   {
+      // Drains posted before the move are for us now
+      if (_queue)
+         _queue->owner = this;
+   }
+
+   log_view& log_view::operator=(log_view&& rhs)
+   {
+      if (this != &rhs)
+      {
+         element::operator=(std::move(rhs));
+         _max_lines = rhs._max_lines;
+         _layout = std::move(rhs._layout);
+         _color = rhs._color;
+         _lines = std::move(rhs._lines);
+         _queue = std::move(rhs._queue);
+         _at_tail = rhs._at_tail;
+         _scroll_to_tail = rhs._scroll_to_tail;
+         if (_queue)
+            _queue->owner = this;
+      }
+      return *this;
+   }
+
+   float log_view::line_height() const
+   {
+      auto metrics = _layout.metrics();
+      return metrics.ascent + metrics.descent + metrics.leading;
+   }
+
+   view_limits log_view::limits(basic_context const& /* ctx */) const
+   {
+      auto height = std::max<std::size_t>(_lines.size(), 1) * line_height();
+      return { { 200, height }, { full_extent, height } };
+   }
+
+   void log_view::layout(context const& ctx)
+   {
+      if (!_queue->view_.exchange(&ctx.view))
+         take_lines();  // Lines appended before we had a view
+
+      if (_scroll_to_tail)
+      {
+         _scroll_to_tail = false;
+         auto  bottom = ctx.bounds.top + _lines.size() * line_height();
+         scrollable::find(ctx).scroll_into_view(
+            rect{ ctx.bounds.left, bottom - line_height(), ctx.bounds.left + 1, bottom }
+         );
+      }
+   }
+
+   void log_view::draw(context const& ctx)
+   {
+      auto& cnv = ctx.canvas;
+      auto  state = cnv.new_state();
+      auto  metrics = _layout.metrics();
+      auto  line_height_ = line_height();
+      auto  visible = min(ctx.bounds, cnv.clip_extent());
+
+      // Follow the tail for as long as the last line is in view
+      _at_tail = visible.bottom >= ctx.bounds.bottom - (line_height_ / 2);
+
+      if (visible.top >= visible.bottom || line_height_ <= 0 || _lines.empty())
+         return;
+
+      cnv.rect(ctx.bounds);
+      cnv.clip();
+      cnv.fill_style(_color);
+
+      // Rows have uniform heights, so the visible rows are a straight
+      // computation from the clip extent. Only those are shaped.
+      auto  top = std::max(0.0f, std::floor((visible.top - ctx.bounds.top) / line_height_));
+      auto  bottom = std::max(0.0f, std::ceil((visible.bottom - ctx.bounds.top) / line_height_));
+      auto  first = std::min(std::size_t(top), _lines.size());
+      auto  last = std::min(std::size_t(bottom), _lines.size());
+
+      auto  y = ctx.bounds.top + metrics.ascent + first * line_height_;
+      for (auto i = first; i != last; ++i)
+      {
+         auto& line_ = *_lines[i];
+         if (!line_.layout)
+            line_.layout = std::make_unique<master_glyphs>(line_.text, _layout);
+         line_.layout->draw({ ctx.bounds.left, y }, cnv);
+         y += line_height_;
+      }
+   }
+
+   void log_view::append(string_view line_)
+   {
+      // Split multi-line text into lines
+      auto first = line_.data();
+      auto last = first + line_.size();
+      while (true)
+      {
+         auto nl = std::find(first, last, '\n');
+         _queue->push(string_view(first, nl - first));
+         if (nl == last)
+            break;
+         first = nl + 1;
+      }
+
+      // Post a single drain per batch
+      auto view_ = _queue->view_.load();
+      if (view_ && !_queue->posted.exchange(true))
+      {
+         std::weak_ptr<queue> weak_queue = _queue;
+         view_->post(
+            [weak_queue]()
+            {
+               if (auto q = weak_queue.lock())
+                  q->owner->drain();
+            }
+         );
+      }
+   }
+
+   void log_view::clear()
+   {
+      for (auto n = _queue->take(); n;)
+      {
+         auto next = n->next;
+         delete n;
+         n = next;
+      }
+
+      _lines.clear();
+      if (auto view_ = _queue->view_.load())
+         view_->layout(*this);
+   }
+
+   bool log_view::take_lines()
+   {
+      auto n = _queue->take();
+      if (!n)
+         return false;
+
+      while (n)
+      {
+         auto next = n->next;
+         _lines.push_back(std::make_unique<line>(std::move(n->text)));
+         delete n;
+         n = next;
+      }
+
+      // Drop the oldest lines
+      if (_lines.size() > _max_lines)
+         _lines.erase(_lines.begin(), _lines.begin() + (_lines.size() - _max_lines));
+
+      _scroll_to_tail = _at_tail;
+      return true;
+   }
+
+   void log_view::drain()
+   {
+      _queue->posted = false;
+      auto size_ = _lines.size();
+      if (!take_lines())
+         return;
+
+      auto view_ = _queue->view_.load();
+      if (_scroll_to_tail || _lines.size() != size_)
+         view_->layout(*this);
+      else
+         view_->refresh(*this);
+   }
+}}
@@ -9,6 +9,12 @@
 #include <elements/support/text_utils.hpp>
 #include <elements/support/context.hpp>
 #include <elements/view.hpp>
+#include <asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iterator>
+#include <mutex>
 #include <utility>
 
 namespace cycfi { namespace elements
@@ -18,21 +24,102 @@ namespace cycfi { namespace elements
    ////////////////////////////////////////////////////////////////////////////
    // Static Text Box
    ////////////////////////////////////////////////////////////////////////////
+   static_text_box::paragraph::paragraph(
+      text_buffer::line_ptr line
+    , master_glyphs const& source
+    , bool shape
+   )
+    : text(std::move(line))
+    , layout(text->data(), text->data() + (shape? text->size() : 0), source)
+    , shaped(shape)
+   {}
+
+   // Paragraphs that are too many to shape on the UI thread start out
+   // as empty placeholders, and are shaped and wrapped by a layout_job
+   // on a worker thread. Shaped paragraphs are handed back in done, and
+   // moved in place on the UI thread.
+   struct static_text_box::layout_job
+   {
+      using todo_list = std::vector<std::pair<std::size_t, text_buffer::line_ptr>>;
+      using done_list = std::vector<std::pair<std::size_t, paragraph>>;
+
+                              layout_job(master_glyphs const& source_, float width_);
+
+      master_glyphs           source;
+      float                   width;
+      todo_list               todo;
+      std::atomic<bool>       cancelled{ false };
+
+      std::mutex              done_mutex;
+      done_list               done;
+      bool                    finished = false;
+   };
+
+   static_text_box::layout_job::layout_job(master_glyphs const& source_, float width_)
+    : source(string_view{ "" }, source_)
+    , width(width_)
+   {}
+
+   namespace
+   {
+      asio::thread_pool& text_layout_pool()
+      {
+         static asio::thread_pool pool{ 1 };
+         return pool;
+      }
+   }
+
    static_text_box::static_text_box(
       std::string text
     , font font_
     , float size
     , color color_
    )
-    : _text(std::move(text))
-    , _layout(_text.data(), _text.data() + _text.size(), font_, size)
+    : _text(text)
+    , _layout(string_view{ "" }, font_, size)
     , _color(color_)
    {}
 
-   view_limits static_text_box::limits(basic_context const& /* ctx */) const
+   static_text_box::static_text_box(static_text_box&& rhs)
+    : element(std::move(rhs))
+    , text_reader(std::move(rhs))
+    , text_writer(std::move(rhs))
+    , receiver<std::string>(std::move(rhs))
+    , _text(std::move(rhs._text))
+    , _flat_text(std::move(rhs._flat_text))
+    , _flat_source(std::move(rhs._flat_source))
+    , _layout(std::move(rhs._layout))
+    , _paragraphs(std::move(rhs._paragraphs))
+    , _num_rows(rhs._num_rows)
+    , _color(rhs._color)
+    , _current_size(rhs._current_size)
+    , _async_min_bytes(rhs._async_min_bytes)
+    , _needs_job(rhs._needs_job || rhs._job)
+    , _first_visible_row(rhs._first_visible_row)
    {
-      sync();
+      // An in-flight layout job delivers its results to rhs. Cancel it.
+      // We start a new one for the paragraphs still unshaped on our next
+      // layout.
+      if (rhs._job)
+      {
+         rhs._job->cancelled = true;
+         rhs._job.reset();
+      }
+   }
 
+   static_text_box::~static_text_box()
+   {
+      if (_job)
+         _job->cancelled = true;
+   }
+
+   void static_text_box::async_layout(std::size_t min_bytes)
+   {
+      _async_min_bytes = min_bytes;
+   }
+
+   view_limits static_text_box::limits(basic_context const& /* ctx */) const
+   {
       auto  size = _layout.metrics();
       auto  min_line_height = size.ascent + size.descent + size.leading;
       float line_height =
@@ -51,11 +138,12 @@ namespace cycfi { namespace elements
    {
       sync();
 
-      _rows.clear();
       auto  new_x = ctx.bounds.width();
-      _layout.break_lines(new_x, _rows);
+      wrap(new_x);
+      if (_needs_job)
+         start_layout_job(ctx);
       auto  size = _layout.metrics();
-      auto  new_y = _rows.size() * (size.ascent + size.descent + size.leading);
+      auto  new_y = _num_rows * (size.ascent + size.descent + size.leading);
 
       // Refresh the union of the old and new bounds if the size has changed
       if (_current_size.x != new_x || _current_size.y != new_y)
@@ -78,35 +166,322 @@ namespace cycfi { namespace elements
       auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
       auto  x = ctx.bounds.left;
       auto  y = ctx.bounds.top + metrics.ascent;
-      auto  clip_extent = cnv.clip_extent();
 
       cnv.rect(ctx.bounds);
       cnv.clip();
       cnv.fill_style(_color);
-      for (auto& row : _rows)
+
+      // Draw only the rows that are visible
+      auto  rows = update_visible_rows(ctx);
+      y += rows.first * line_height;
+      auto  i = find_paragraph(rows.first);
+      for (auto r = rows.first; r < rows.second; ++i)
+      {
+         auto& para = _paragraphs[i];
+         for (auto j = r - para.first_row; j < para.rows.size() && r < rows.second; ++j, ++r)
+         {
+            para.rows[j].draw({ x, y }, cnv);
+            y += line_height;
+         }
+      }
+   }
+
+   static_text_box::row_range static_text_box::visible_rows(context const& ctx) const
+   {
+      // Rows have uniform heights, so the visible rows are a straight
+      // computation from the clip extent.
+      auto  metrics = _layout.metrics();
+      auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
+      auto  visible = min(ctx.bounds, ctx.canvas.clip_extent());
+      if (visible.top >= visible.bottom || line_height <= 0)
+         return { 0, 0 };
+
+      auto  top = std::max(0.0f, std::floor((visible.top - ctx.bounds.top) / line_height));
+      auto  bottom = std::max(0.0f, std::ceil((visible.bottom - ctx.bounds.top) / line_height));
+      auto  first = std::min(std::size_t(top), _num_rows);
+      auto  last = std::min(std::size_t(bottom), _num_rows);
+      return { first, last };
+   }
+
+   static_text_box::row_range static_text_box::update_visible_rows(context const& ctx)
+   {
+      // Same as visible_rows, noting the first row so that the layout job
+      // starts from the rows in view.
+      auto rows = visible_rows(ctx);
+      _first_visible_row = rows.first;
+      return rows;
+   }
+
+   std::size_t static_text_box::find_paragraph(std::size_t row) const
+   {
+      // Binary search for the paragraph that has the row
+      auto i = std::upper_bound(
+         _paragraphs.begin(), _paragraphs.end(), row,
+         [](std::size_t row, paragraph const& para)
+         {
+            return row < para.first_row;
+         }
+      );
+      return std::size_t(std::max(i, _paragraphs.begin() + 1) - _paragraphs.begin()) - 1;
+   }
+
+   std::size_t static_text_box::paragraph_at(std::size_t offset) const
+   {
+      // Binary search for the paragraph that has the offset
+      auto i = std::upper_bound(
+         _paragraphs.begin(), _paragraphs.end(), offset,
+         [](std::size_t offset, paragraph const& para)
+         {
+            return offset < para.offset;
+         }
+      );
+      return std::size_t(std::max(i, _paragraphs.begin() + 1) - _paragraphs.begin()) - 1;
+   }
+
+   std::size_t static_text_box::row_begin(std::size_t row) const
+   {
+      auto const& para = _paragraphs[find_paragraph(row)];
+      auto const& row_ = para.rows[row - para.first_row];
+      return para.offset + (row_.begin() - para.text->data());
+   }
+
+   std::size_t static_text_box::row_end(std::size_t row) const
+   {
+      // The last row of a paragraph extends up to the newline
+      auto const& para = _paragraphs[find_paragraph(row)];
+      auto        index = row - para.first_row;
+      if (index == para.rows.size() - 1)
+         return para.offset + para.text->size();
+      return para.offset + (para.rows[index].end() - para.text->data());
+   }
+
+   void static_text_box::sync()
+   {
+      // Bring the paragraphs in sync with _text. The lines of the text
+      // buffer that were not touched by an edit (or an undo) are the very
+      // same objects that our paragraphs hold, so we skip the leading and
+      // trailing paragraphs that are still the same, comparing pointers,
+      // and reshape only the lines left in between. That is typically a
+      // single line.
+      std::size_t num_paras = _paragraphs.size();
+      std::size_t num_lines = _text.num_lines();
+      std::size_t first = 0;           // First paragraph that changed
+      std::size_t last = num_paras;    // One past the last paragraph that changed
+      std::size_t last_line = num_lines;
+
+      _text.for_each_line(
+         [&](text_buffer::line_ptr const& line)
+         {
+            if (first == num_paras || _paragraphs[first].text != line)
+               return false;
+            ++first;
+            return true;
+         }
+      );
+
+      if (first == num_paras && first == num_lines)
+         return;  // Nothing changed
+
+      _text.for_each_line_reverse(
+         [&](text_buffer::line_ptr const& line)
+         {
+            if (last == first || last_line == first || _paragraphs[last-1].text != line)
+               return false;
+            --last;
+            --last_line;
+            return true;
+         }
+      );
+
+      // Lay out the lines in between as new paragraphs. If there is too
+      // much to lay out, leave it to a layout_job (see layout).
+      std::size_t num_bytes = 0;
+      if (_async_min_bytes)
+      {
+         std::size_t n = 0;
+         _text.for_each_line(
+            [&](text_buffer::line_ptr const& line)
+            {
+               if (n++ == last_line - first)
+                  return false;
+               num_bytes += line->size();
+               return num_bytes <= _async_min_bytes;
+            }
+          , first
+         );
+      }
+      bool shape = !_async_min_bytes || num_bytes <= _async_min_bytes;
+
+      std::vector<paragraph> paras;
+      paras.reserve(last_line - first);
+      _text.for_each_line(
+         [&](text_buffer::line_ptr const& line)
+         {
+            if (paras.size() == last_line - first)
+               return false;
+            paras.emplace_back(line, _layout, shape);
+            return true;
+         }
+       , first
+      );
+
+      // A running job refers to paragraphs by index. If these shifted, the
+      // job's results are stale. Start over.
+      if (!shape || (_job && (last - first) != paras.size()))
+      {
+         if (_job)
+            _job->cancelled = true;
+         _job.reset();
+         _needs_job = true;
+      }
+
+      _paragraphs.erase(_paragraphs.begin() + first, _paragraphs.begin() + last);
+      _paragraphs.insert(
+         _paragraphs.begin() + first
+       , std::make_move_iterator(paras.begin())
+       , std::make_move_iterator(paras.end())
+      );
+   }
+
+   void static_text_box::wrap(float width)
+   {
+      // Rewrap only the paragraphs that have not been wrapped at this width
+      // yet, and update the paragraph offsets.
+      std::size_t offset = 0;
+      _num_rows = 0;
+      for (auto& para : _paragraphs)
+      {
+         if (para.width != width)
+         {
+            para.rows.clear();
+            para.layout.break_lines(width, para.rows);
+            para.width = width;
+         }
+         para.offset = offset;
+         para.first_row = _num_rows;
+         offset += para.text->size() + 1;
+         _num_rows += para.rows.size();
+      }
+   }
+
+   void static_text_box::start_layout_job(context const& ctx)
+   {
+      if (_job)
+         _job->cancelled = true;
+      _job.reset();
+      _needs_job = false;
+
+      // Lay out the paragraphs from the first visible row onwards, then
+      // the ones above it.
+      auto  job = std::make_shared<layout_job>(_layout, ctx.bounds.width());
+      auto  n = _paragraphs.size();
+      auto  start = _paragraphs.empty()? 0 : find_paragraph(_first_visible_row);
+      for (std::size_t k = 0; k != n; ++k)
+      {
+         auto i = (start + k) % n;
+         if (!_paragraphs[i].shaped)
+            job->todo.emplace_back(i, _paragraphs[i].text);
+      }
+      if (job->todo.empty())
+         return;
+      _job = job;
+
+      std::weak_ptr<layout_job> weak_job = job;
+      asio::post(text_layout_pool(),
+         [job, weak_job, &view_ = ctx.view, this]()
+         {
+            using clock = std::chrono::steady_clock;
+
+            // Hand the shaped paragraphs over to the UI thread in batches
+            auto  deliver = [&](bool finished)
+            {
+               {
+                  std::lock_guard<std::mutex> lock(job->done_mutex);
+                  job->finished = finished;
+               }
+               view_.post(
+                  [weak_job, &view_, this]()
+                  {
+                     auto job = weak_job.lock();
+                     if (job && !job->cancelled && job == _job)
+                        apply_layout_job(view_);
+                  }
+               );
+            };
+
+            auto  batch_start = clock::now();
+            auto  num_todo = job->todo.size();
+            for (std::size_t k = 0; k != num_todo; ++k)
+            {
+               if (job->cancelled)
+                  return;
+
+               auto const& [index, line] = job->todo[k];
+               paragraph para{ line, job->source };
+               para.layout.break_lines(job->width, para.rows);
+               para.width = job->width;
+               {
+                  std::lock_guard<std::mutex> lock(job->done_mutex);
+                  job->done.emplace_back(index, std::move(para));
+               }
+
+               if (k + 1 == num_todo)
+                  deliver(true);
+               else if (clock::now() - batch_start > 50ms)
+               {
+                  deliver(false);
+                  batch_start = clock::now();
+               }
+            }
+         }
+      );
+   }
+
+   void static_text_box::apply_layout_job(view& view_)
+   {
+      layout_job::done_list done;
+      bool finished;
+      {
+         std::lock_guard<std::mutex> lock(_job->done_mutex);
+         done.swap(_job->done);
+         finished = _job->finished;
+      }
+
+      for (auto& [index, para] : done)
       {
-         if (y + metrics.descent > clip_extent.top)
-            row.draw({ x, y }, cnv);
-         y += line_height;
-         if (y > ctx.bounds.bottom + metrics.ascent)
-            break;
+         if (index < _paragraphs.size()
+            && !_paragraphs[index].shaped
+            && _paragraphs[index].text == para.text)
+         {
+            _paragraphs[index] = std::move(para);
+         }
       }
+
+      if (finished)
+         _job.reset();
+
+      // Update the row indices and relayout, which also restarts the job
+      // if edits left some paragraphs unshaped.
+      wrap(_current_size.x);
+      view_.layout(*this);
    }
 
-   void static_text_box::sync() const
+   std::string const& static_text_box::get_text() const
    {
-      auto f = _text.data();
-      auto l = _text.data() + _text.size();
-      if (f != _layout.begin() || l != _layout.end())
-         _layout.text(f, l);
+      // Flatten the text only when asked, and only once per edit
+      if (!_flat_source.shares(_text))
+      {
+         _flat_text = _text.str();
+         _flat_source = _text;
+      }
+      return _flat_text;
    }
 
    void static_text_box::set_text(string_view text)
    {
-      _text = std::string(text);
-      _rows.clear();
-      _layout.text(_text.data(), _text.data() + _text.size());
-      _layout.break_lines(_current_size.x, _rows);
+      _text = text_buffer{ text };
+      sync();
+      wrap(_current_size.x);
    }
 
    void static_text_box::value(string_view val)
@@ -122,6 +497,8 @@ namespace cycfi { namespace elements
     , _select_start(-1)
     , _select_end(-1)
     , _current_x(0)
+    , _typing_mark{ 0, -1, -1 }
+    , _is_typing(false)
     , _is_focus(false)
     , _show_caret(true)
     , _caret_started(false)
@@ -154,44 +531,37 @@ namespace cycfi { namespace elements
          return true;
       }
 
-      char const*   _first = _text.data();
-      char const*   _last = _first + _text.size();
-
-      if (char const* pos = caret_position(ctx, btn.pos))
+      int pos = caret_position(ctx, btn.pos);
+      if (pos != -1)
       {
          if (btn.num_clicks != 1)
          {
-            char const* end = pos;
-            char const* start = pos;
-
-            auto fixup = [&]()
-            {
-               if (start != _first)
-                  start = next_utf8(_last, start);
-               _select_start = int(start - _first);
-               _select_end = int(end - _first);
-            };
+            int   last = int(_text.size());
+            int   end = pos;
+            int   start = pos;
 
             if (btn.num_clicks == 2)
             {
-               while (end < _last && !word_break(end))
-                  end = next_utf8(_last, end);
-               while (start > _first && !word_break(start))
-                  start = prev_utf8(_first, start);
-               fixup();
+               while (end < last && !word_break(utf8_at(end)))
+                  end = int(_text.next(end));
+               while (start > 0 && !word_break(utf8_at(start)))
+                  start = int(_text.prev(start));
+               if (start != 0)
+                  start = int(_text.next(start));
             }
             else if (btn.num_clicks == 3)
             {
-               while (end < _last && !is_newline(uint8_t(*end)))
-                  end++;
-               while (start > _first && !is_newline(uint8_t(*start)))
-                  start--;
-               fixup();
+               std::size_t line_start;
+               auto line = _text.line_at(pos, line_start);
+               start = int(line_start);
+               end = int(line_start + line.size());
             }
+            _select_start = start;
+            _select_end = end;
          }
          else
          {
-            auto hit = int(pos - _first);
+            auto hit = pos;
             if ((btn.modifiers == mod_shift) && (_select_start != -1))
             {
                if (hit < _select_start)
@@ -212,10 +582,10 @@ namespace cycfi { namespace elements
 
    void basic_text_box::drag(context const& ctx, mouse_button btn)
    {
-      char const* first = &_text[0];
-      if (char const* pos = caret_position(ctx, btn.pos))
+      int pos = caret_position(ctx, btn.pos);
+      if (pos != -1)
       {
-         _select_end = int(pos-first);
+         _select_end = pos;
          ctx.view.refresh(ctx);
          scroll_into_view(ctx, true);
       }
@@ -231,24 +601,6 @@ namespace cycfi { namespace elements
       return false;
    }
 
-   namespace
-   {
-      void add_undo(
-         context const& ctx
-       , std::function<void()>& typing_state
-       , std::function<void()> undo_f
-       , std::function<void()> redo_f
-      )
-      {
-         if (typing_state)
-         {
-            ctx.view.add_undo({ typing_state, undo_f });
-            typing_state = {}; // reset
-         }
-         ctx.view.add_undo({ undo_f, redo_f });
-      }
-   }
-
    void break_()
    {
    }
@@ -265,21 +617,15 @@ namespace cycfi { namespace elements
 
       std::string text = codepoint_to_utf8(info_.codepoint);
 
-      if (!_typing_state)
-         _typing_state = capture_state();
-
-      bool replace = false;
-      if (_select_start == _select_end)
+      if (!_is_typing)
       {
-         _text.insert(_select_start, text);
-      }
-      else
-      {
-         _text.replace(_select_start, _select_end-_select_start, text);
-         replace = true;
+         _typing_mark = mark_undo();
+         _is_typing = true;
       }
 
-      _layout.text(_text.data(), _text.data() + _text.size());
+      bool replace = _select_start != _select_end;
+      replace_text(_select_start, _select_end-_select_start, text);
+
       layout(ctx);
 
       if (replace)
@@ -299,6 +645,15 @@ namespace cycfi { namespace elements
    void basic_text_box::set_text(string_view text_)
    {
       static_text_box::set_text(text_);
+
+      // The journal (and the undo steps already handed to the view) refer
+      // to the old text. Drop them: pending edits are discarded, and undo
+      // steps from before are ignored when undone or redone.
+      _edits.clear();
+      _edit_floor = 0;
+      _is_typing = false;
+      ++_undo_generation;
+
       _select_start = std::min<int>(_select_start, text_.size());
       _select_end = std::min<int>(_select_end, text_.size());
    }
@@ -319,20 +674,20 @@ namespace cycfi { namespace elements
 
       int start = std::min(_select_end, _select_start);
       int end = std::max(_select_end, _select_start);
-      std::function<void()> undo_f = capture_state();
+      auto  mark = mark_undo();
 
       auto up_down = [this, &ctx, k, &move_caret]()
       {
          bool up = k.key == key_code::up;
          glyph_metrics info;
-         info = glyph_info(ctx, &_text[_select_end]);
-         if (info.str)
+         info = glyph_info(ctx, _select_end);
+         if (info.index != -1)
          {
             auto y = up ? -info.line_height : +info.line_height;
             auto pos = point{ ctx.bounds.left + _current_x, info.pos.y + y };
-            char const* cp = caret_position(ctx, pos);
-            if (cp)
-               _select_end = int(cp - &_text[0]);
+            int cp = caret_position(ctx, pos);
+            if (cp != -1)
+               _select_end = cp;
             else
                _select_end = up ? 0 : int(_text.size());
             move_caret = true;
@@ -342,34 +697,26 @@ namespace cycfi { namespace elements
       auto next_char = [this]()
       {
          if (_select_end < static_cast<int>(_text.size()))
-         {
-            char const* end = _text.data() + _text.size();
-            char const* p = next_utf8(end, &_text[_select_end]);
-            _select_end = int(p - &_text[0]);
-         }
+            _select_end = int(_text.next(_select_end));
       };
 
       auto prev_char = [this]()
       {
          if (_select_end > 0)
-         {
-            char const* start = &_text[0];
-            char const* p = prev_utf8(start, &_text[_select_end]);
-            _select_end = int(p - &_text[0]);
-         }
+            _select_end = int(_text.prev(_select_end));
       };
 
       auto next_word = [this]()
       {
-         if (_select_end < static_cast<int>(_text.size()))
+         int end = int(_text.size());
+         if (_select_end < end)
          {
-            char const* p = &_text[_select_end];
-            char const* end = _text.data() + _text.size();
-            while (p != end && word_break(p))
-               p = next_utf8(end, p);
-            while (p != end && !word_break(p))
-               p = next_utf8(end, p);
-            _select_end = int(p - &_text[0]);
+            int p = _select_end;
+            while (p != end && word_break(utf8_at(p)))
+               p = int(_text.next(p));
+            while (p != end && !word_break(utf8_at(p)))
+               p = int(_text.next(p));
+            _select_end = p;
          }
       };
 
@@ -377,18 +724,14 @@ namespace cycfi { namespace elements
       {
          if (_select_end > 0)
          {
-            char const* start = &_text[0];
-            char const* p = prev_utf8(start, &_text[_select_end]);
-            while (p != start && word_break(p))
-               p = prev_utf8(start, p);
-            while (p != start && !word_break(p))
-               p = prev_utf8(start, p);
-            if (p != start)
-            {
-               char const* end = _text.data() + _text.size();
-               p = next_utf8(end, p);
-            }
-            _select_end = int(p - &_text[0]);
+            int p = int(_text.prev(_select_end));
+            while (p != 0 && word_break(utf8_at(p)))
+               p = int(_text.prev(p));
+            while (p != 0 && !word_break(utf8_at(p)))
+               p = int(_text.prev(p));
+            if (p != 0)
+               p = int(_text.next(p));
+            _select_end = p;
          }
       };
 
@@ -398,11 +741,11 @@ namespace cycfi { namespace elements
          {
             case key_code::enter:
                {
-                  _text.replace(start, end-start, "\n");
+                  replace_text(start, end-start, "\n");
                   _select_start += 1;
                   _select_end = _select_start;
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
+                  commit_undo(ctx.view, mark);
                   handled = true;
                }
                break;
@@ -412,7 +755,7 @@ namespace cycfi { namespace elements
                {
                   delete_(k.key == key_code::_delete);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
+                  commit_undo(ctx.view, mark);
                   handled = true;
                }
                break;
@@ -468,7 +811,7 @@ namespace cycfi { namespace elements
                {
                   cut(ctx.view, start, end);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
+                  commit_undo(ctx.view, mark);
                   handled = true;
                }
                break;
@@ -486,7 +829,7 @@ namespace cycfi { namespace elements
                {
                   paste(ctx.view, start, end);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
+                  commit_undo(ctx.view, mark);
                   handled = true;
                }
                break;
@@ -494,11 +837,7 @@ namespace cycfi { namespace elements
             case key_code::z:
                if (k.modifiers & mod_action)
                {
-                  if (_typing_state)
-                  {
-                     ctx.view.add_undo({ _typing_state, undo_f });
-                     _typing_state = {}; // reset
-                  }
+                  commit_typing(ctx.view, mark);
 
                   if (k.modifiers & mod_shift)
                      ctx.view.redo();
@@ -522,7 +861,6 @@ namespace cycfi { namespace elements
       }
       else if (handled)
       {
-         _layout.text(_text.data(), _text.data() + _text.size());
          layout(ctx);
          ctx.view.refresh(ctx);
       }
@@ -571,7 +909,12 @@ namespace cycfi { namespace elements
       // Draw the caret
       else if (_is_focus && (_select_start != -1) && (_select_start == _select_end))
       {
-         auto  start_info = glyph_info(ctx, _text.data() + _select_start);
+         // Nothing to do if the caret is not visible
+         auto  visible = visible_text(ctx);
+         if (visible.first == -1 || _select_start < visible.first || _select_start > visible.second)
+            return;
+
+         auto  start_info = glyph_info(ctx, _select_start);
          auto width = theme.text_box_caret_width;
          rect& caret = start_info.bounds;
 
@@ -616,11 +959,22 @@ namespace cycfi { namespace elements
 
       if (!_text.empty())
       {
-         auto  start_info = glyph_info(ctx, _text.data() + _select_start);
+         // Clip the selection to the visible text. Since the visible range
+         // has a row of slack on both ends, the visible part of the
+         // selection is drawn exactly the same.
+         auto  visible = visible_text(ctx);
+         auto  lo = std::min(_select_start, _select_end);
+         auto  hi = std::max(_select_start, _select_end);
+         if (visible.first == -1 || hi < visible.first || lo > visible.second)
+            return;
+         auto  select_start = std::clamp(_select_start, visible.first, visible.second);
+         auto  select_end = std::clamp(_select_end, visible.first, visible.second);
+
+         auto  start_info = glyph_info(ctx, select_start);
          rect& r1 = start_info.bounds;
          r1.right = ctx.bounds.right;
 
-         auto  end_info = glyph_info(ctx, _text.data() + _select_end);
+         auto  end_info = glyph_info(ctx, select_end);
          rect& r2 = end_info.bounds;
          r2.right = r2.left;
          r2.left = ctx.bounds.left;
@@ -650,49 +1004,52 @@ namespace cycfi { namespace elements
       }
    }
 
-   char const* basic_text_box::caret_position(context const& ctx, point p)
+   std::pair<int, int> basic_text_box::visible_text(context const& ctx) const
+   {
+      // The range of text in the visible rows, plus one row above and one
+      // row below, or { -1, -1 } if there is none.
+      auto  rows = visible_rows(ctx);
+      if (_num_rows == 0)
+         return { -1, -1 };
+      auto  first = rows.first > 0 ? rows.first - 1 : 0;
+      auto  last = std::min(rows.second + 1, _num_rows);
+      if (first >= last)
+         return { -1, -1 };
+      return { int(row_begin(first)), int(row_end(last - 1)) };
+   }
+
+   int basic_text_box::caret_position(context const& ctx, point p)
    {
       auto  x = ctx.bounds.left;
       auto  y = ctx.bounds.top;
       auto  metrics = _layout.metrics();
       auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
 
-      char const* found = nullptr;
-      for (auto& row : _rows)
-      {
-         // Check if p is within this row
-         if ((p.y >= y) && (p.y < y + line_height))
-         {
-            // Check if we are at the very start of the row or beyond
-            if (p.x <= x)
-            {
-               found = row.begin();
-               break;
-            }
+      // Rows have uniform heights, so the row at p is a simple division
+      if (p.y < y || line_height <= 0)
+         return -1;
+      auto  row = std::size_t((p.y - y) / line_height);
+      if (row >= _num_rows)
+         return -1;
 
-            // Get the actual coordinates of the glyph
-            row.for_each(
-               [p, x, &found](char const* utf8, float left, float right)
-               {
-                  if ((p.x >= (x + left)) && (p.x < (x + right)))
-                  {
-                     found = utf8;
-                     return false;
-                  }
-                  return true;
-               }
-            );
-            // Assume it's at the end of the row if we haven't found a hit
-            if (!found)
-               found = row.end();
-            break;
-         }
-         y += line_height;
+      auto const& para = _paragraphs[find_paragraph(row)];
+      auto const& row_ = para.rows[row - para.first_row];
+
+      // Check if we are at the very start of the row or beyond. Otherwise,
+      // assume it's at the end of the row if we haven't found a hit.
+      char const* found = row_.begin();
+      if (p.x > x)
+      {
+         found = row_.glyph_at(p.x - x);
+         if (!found)
+            found = row_.end();
       }
-      return found;
+
+      // Map the position in the paragraph back to the text
+      return int(para.offset + (found - para.text->data()));
    }
 
-   basic_text_box::glyph_metrics basic_text_box::glyph_info(context const& ctx, char const* s)
+   basic_text_box::glyph_metrics basic_text_box::glyph_info(context const& ctx, int index)
    {
       auto  metrics = _layout.metrics();
       auto  x = ctx.bounds.left;
@@ -703,59 +1060,64 @@ namespace cycfi { namespace elements
       auto  line_height = ascent + descent + leading;
 
       glyph_metrics info;
-      info.str = nullptr;
+      info.index = -1;
       info.line_height = line_height;
 
-      // Check if s is at the very end
-      if (s == _text.data() + _text.size())
+      if (index < 0 || _paragraphs.empty())
+         return info;
+
+      auto  offset = std::min(std::size_t(index), _text.size());
+      auto const& para = _paragraphs[paragraph_at(offset)];
+
+      // Check if s is at the very end of the paragraph (i.e. at the
+      // newline, or at the very end of the text)
+      auto  para_end = para.offset + para.text->size();
+      if (offset == para_end)
       {
-         auto const& last_row = _rows.back();
+         auto const& last_row = para.rows.back();
          auto        rightmost = x + last_row.width();
-         auto        bottom_y = y + (line_height * (_rows.size() - 1));
+         auto        bottom_y = y + (line_height * (para.first_row + para.rows.size() - 1));
 
          info.pos = { rightmost, bottom_y };
          info.bounds = { rightmost, bottom_y - ascent, rightmost + 10, bottom_y + descent };
-         info.str = s;
+         info.index = index;
          return info;
       }
 
-      glyphs*  prev_row = nullptr;
-      for (auto& row : _rows)
-      {
-         // Check if s is within this row
-         if (s >= row.begin() && s < row.end())
+      // Binary search for the last row that starts at or before s
+      auto  local_s = para.text->data() + (offset - para.offset);
+      auto  i = std::upper_bound(
+         para.rows.begin(), para.rows.end(), local_s,
+         [](char const* s, glyphs const& row)
          {
-            // Get the actual coordinates of the glyph
-            row.for_each(
-               [s, &info, x, y, ascent, descent](char const* utf8, float left, float right)
-               {
-                  if (utf8 >= s)
-                  {
-                     info.pos = { x + left, y };
-                     info.bounds = { x + left, y - ascent, x + right, y + descent };
-                     info.str = utf8;
-                     return false;
-                  }
-                  return true;
-               }
-            );
-            break;
+            return s < row.begin();
          }
-         // This handles the case where s is in between the start of the
-         // current row and the end of the previous.
-         else if (s < row.begin() && prev_row)
-         {
-            auto  rightmost = x + prev_row->width();
-            auto  prev_y = y - line_height;
-            info.pos = { rightmost, prev_y };
-            info.bounds = { rightmost, prev_y - ascent, rightmost + 10, prev_y + descent };
-            info.str = s;
-            break;
-         }
-         y += line_height;
-         prev_row = &row;
+      );
+      if (i == para.rows.begin())
+         return info;
+
+      auto const& row = *(i - 1);
+      auto        row_y = y + (line_height * (para.first_row + (i - 1 - para.rows.begin())));
+
+      // Get the actual coordinates of the glyph
+      float left, right;
+      auto  found = (local_s < row.end())? row.glyph_bounds(local_s, left, right) : nullptr;
+      if (found)
+      {
+         info.pos = { x + left, row_y };
+         info.bounds = { x + left, row_y - ascent, x + right, row_y + descent };
+         info.index = int(para.offset + (found - para.text->data()));
       }
 
+      // This handles the case where s is in between the end of the row
+      // and the start of the next.
+      else
+      {
+         auto  rightmost = x + row.width();
+         info.pos = { rightmost, row_y };
+         info.bounds = { rightmost, row_y - ascent, rightmost + 10, row_y + descent };
+         info.index = index;
+      }
       return info;
    }
 
@@ -769,24 +1131,19 @@ namespace cycfi { namespace elements
          {
             if (forward)
             {
-               char const* start_p = &_text[start];
-               char const* end_p = &_text[0] + _text.size();
-               char const* p = next_utf8(end_p, start_p);
-               start = int(start_p - &_text[0]);
-               _text.erase(start, p - start_p);
+               int next = int(_text.next(start));
+               replace_text(start, next - start, {});
             }
             else if (start > 0)
             {
-               char const* start_p = &_text[0];
-               char const* end_p = &_text[start];
-               char const* p = prev_utf8(start_p, end_p);
-               start = int(p - &_text[0]);
-               _text.erase(start, end_p - p);
+               int prev = int(_text.prev(start));
+               replace_text(prev, start - prev, {});
+               start = prev;
             }
          }
          else
          {
-            _text.erase(start, end-start);
+            replace_text(start, end-start, {});
          }
          _select_end = _select_start = start;
       }
@@ -820,43 +1177,104 @@ namespace cycfi { namespace elements
          auto  end_ = std::max(start, end);
          auto  start_ = std::min(start, end);
          std::string ins = clipboard();
-         _text.replace(start, end_-start_, ins);
+         if (!validate_utf8(ins.data(), ins.data() + ins.size()))
+            ins = repair_utf8(ins.data(), ins.data() + ins.size());
+         replace_text(start, end_-start_, ins);
          start += ins.size();
          _select_end = _select_start = start;
       }
    }
 
-   struct basic_text_box::state_saver
+   void basic_text_box::replace_text(std::size_t pos, std::size_t n, string_view text)
    {
-      state_saver(basic_text_box* this_)
-       : text(this_->_text)
-       , select_start(this_->_select_start)
-       , select_end(this_->_select_end)
-       , save_text(this_->_text)
-       , save_select_start(this_->_select_start)
-       , save_select_end(this_->_select_end)
-      {}
+      text_edit edit{ pos, _text.substr(pos, n), std::string{ text } };
+      _text.replace(pos, n, text);
 
-      void operator()()
+      // Coalesce with the previous edit of the same undo step if they are
+      // adjacent, as in typing or repeated deletes.
+      if (_edits.size() > _edit_floor)
       {
-         text = save_text;
-         select_start = save_select_start;
-         select_end = save_select_end;
+         auto& last = _edits.back();
+         if (pos == last.pos + last.inserted.size())
+         {
+            last.removed += edit.removed;
+            last.inserted += edit.inserted;
+            return;
+         }
+         if (edit.inserted.empty() && last.inserted.empty() && pos + edit.removed.size() == last.pos)
+         {
+            last.pos = pos;
+            last.removed.insert(0, edit.removed);
+            return;
+         }
       }
+      _edits.push_back(std::move(edit));
+   }
 
-      std::string&   text;
-      int&           select_start;
-      int&           select_end;
+   basic_text_box::undo_mark basic_text_box::mark_undo()
+   {
+      _edit_floor = _edits.size();
+      return { _edits.size(), _select_start, _select_end };
+   }
 
-      std::string    save_text;
-      int            save_select_start;
-      int            save_select_end;
-   };
+   void basic_text_box::add_undo(view& v, undo_mark const& from, undo_mark const& to)
+   {
+      // Marks taken before a set_text may be past the (cleared) journal
+      if (from.edit >= to.edit || to.edit > _edits.size())
+         return;
+
+      auto edits = std::make_shared<std::vector<text_edit>>(
+         std::make_move_iterator(_edits.begin() + from.edit)
+       , std::make_move_iterator(_edits.begin() + to.edit)
+      );
+
+      std::size_t size = 0;
+      for (auto const& edit : *edits)
+         size += sizeof(edit) + edit.removed.size() + edit.inserted.size();
 
-   std::function<void()>
-   basic_text_box::capture_state()
+      v.add_undo(
+         {
+            [this, edits, from, generation = _undo_generation]()
+            {
+               if (generation != _undo_generation)
+                  return;
+               for (auto i = edits->rbegin(); i != edits->rend(); ++i)
+                  _text.replace(i->pos, i->inserted.size(), i->removed);
+               _select_start = from.select_start;
+               _select_end = from.select_end;
+            }
+          , [this, edits, to, generation = _undo_generation]()
+            {
+               if (generation != _undo_generation)
+                  return;
+               for (auto const& edit : *edits)
+                  _text.replace(edit.pos, edit.removed.size(), edit.inserted);
+               _select_start = to.select_start;
+               _select_end = to.select_end;
+            }
+          , size
+         }
+      );
+   }
+
+   void basic_text_box::commit_typing(view& v, undo_mark const& to)
    {
-      return state_saver(this);
+      // Add the typing run (if any) up to mark as a single undo step
+      if (_is_typing)
+      {
+         add_undo(v, _typing_mark, to);
+         _is_typing = false;
+      }
+      _edits.erase(_edits.begin(), _edits.begin() + std::min(to.edit, _edits.size()));
+      _edit_floor = 0;
+   }
+
+   void basic_text_box::commit_undo(view& v, undo_mark const& from)
+   {
+      commit_typing(v, from);
+      add_undo(v, { 0, from.select_start, from.select_end }, mark_undo());
+      _edits.clear();
+      _edit_floor = 0;
    }
 
    void basic_text_box::scroll_into_view(context const& ctx, bool save_x)
@@ -879,8 +1297,8 @@ namespace cycfi { namespace elements
       if (_select_end == -1)
          return;
 
-      auto info = glyph_info(ctx, &_text[_select_end]);
-      if (info.str)
+      auto info = glyph_info(ctx, _select_end);
+      if (info.index != -1)
       {
          auto caret = rect{
             info.bounds.left-1,
@@ -948,6 +1366,17 @@ namespace cycfi { namespace elements
       return is_newline(cp);
    }
 
+   char const* basic_text_box::utf8_at(int index) const
+   {
+      // The lines do not include the newlines that separate them
+      std::size_t line_start;
+      auto line = _text.line_at(index, line_start);
+      auto offset = index - line_start;
+      if (offset == line.size())
+         return (std::size_t(index) == _text.size())? "" : "\n";
+      return line.data() + offset;
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // Input Text Box
    ////////////////////////////////////////////////////////////////////////////
@@ -960,7 +1389,7 @@ namespace cycfi { namespace elements
 
    void basic_input_box::draw(context const& ctx)
    {
-      if (get_text().empty())
+      if (_text.empty())
       {
          if (!_placeholder.empty())
          {
@@ -1046,28 +1475,25 @@ namespace cycfi { namespace elements
          if (clip.empty())
             return;
 
-         std::string ins;
+         if (!validate_utf8(clip.data(), clip.data() + clip.size()))
+            clip = repair_utf8(clip.data(), clip.data() + clip.size());
 
          // Copy clip ito ins, stop when a newline is found.
          // Also, limit ins to input_box_text_limit characters.
-         char const* p = &clip[0];
-         char const* last = p + clip.size();
+         char const* first = clip.data();
+         char const* last = std::find_if(first, first + clip.size(),
+            [](char c) { return is_newline(uint8_t(c)); });
 
          auto const max_chars = get_theme().input_box_text_limit;
-         for (std::size_t i = 0; (i < max_chars) && (p != last); ++p, ++i)
-         {
-            if (is_newline(uint8_t(*p)))
-               break;
-            ins += *p;
-         }
+         std::string ins{ first, utf8_offset(first, last, max_chars) };
 
-         _text.replace(start_, end_-start_, ins);
+         replace_text(start_, end_-start_, ins);
          start_ += ins.size();
          select_start(start_);
          select_end(start_);
 
          if (on_text)
-            on_text(_text);
+            on_text(get_text());
       }
    }
 
@@ -1075,7 +1501,7 @@ namespace cycfi { namespace elements
    {
       basic_text_box::delete_(forward);
       if (on_text)
-         on_text(_text);
+         on_text(get_text());
    }
 
    bool basic_input_box::click(context const& ctx, mouse_button btn)
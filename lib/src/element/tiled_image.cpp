@@ -0,0 +1,320 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/tiled_image.hpp>
+#include <elements/support/canvas.hpp>
+#include <elements/support/context.hpp>
+#include <elements/view.hpp>
+#include <asio.hpp>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <unordered_set>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // tile_source implementation
+   ////////////////////////////////////////////////////////////////////////////
+   int tile_source::num_levels() const
+   {
+      auto  size_ = size();
+      auto  extent_ = std::max(size_.x, size_.y);
+      int   levels = 1;
+      for (float ts = tile_size(); ts < extent_; ts *= 2)
+         ++levels;
+      return levels;
+   }
+
+   point tile_source::level_size(int level) const
+   {
+      auto  size_ = size();
+      float div = float(1 << level);
+      return { std::ceil(size_.x / div), std::ceil(size_.y / div) };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tile_directory implementation
+   ////////////////////////////////////////////////////////////////////////////
+   tile_directory::tile_directory(
+      fs::path const& path, point size, int tile_size, std::string ext
+   )
+    : _path(path)
+    , _size(size)
+    , _tile_size(tile_size)
+    , _ext(ext)
+   {}
+
+   pixmap_ptr tile_directory::load(int level, int col, int row) const
+   {
+      auto file = _path / std::to_string(level) /
+         (std::to_string(col) + '_' + std::to_string(row) + _ext);
+
+      std::error_code ec;
+      if (!fs::exists(file, ec))
+         return nullptr;
+      return std::make_shared<pixmap>(file.string().c_str());
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // tiled_image implementation
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      asio::thread_pool& tile_loader_pool()
+      {
+         static asio::thread_pool pool{ 2 };
+         return pool;
+      }
+   }
+
+   // The cache proper (tiles, lru, pending and failed) is accessed only
+   // from the UI thread. Tiles that failed to load, or that the source
+   // does not have, are not requested again. The cache never holds fewer
+   // tiles than are visible (min_capacity), so that visible tiles are
+   // never evicted and reloaded in a loop. The wanted set (the tiles
+   // currently visible) is shared with the loaders, which skip requests
+   // that have scrolled out of view before they got a chance to run.
+   struct tiled_image::tile_cache
+   {
+      using lru_list = std::list<tile_key>;
+      using key_set = std::unordered_set<tile_key>;
+
+      struct entry
+      {
+         pixmap_ptr           pm;
+         lru_list::iterator   pos;
+      };
+
+      void                    insert(tile_key key, pixmap_ptr pm);
+
+      std::size_t             capacity;
+      std::size_t             min_capacity = 0;
+      lru_list                lru;
+      std::unordered_map<tile_key, entry> tiles;
+      key_set                 pending;
+      key_set                 failed;
+
+      std::mutex              wanted_mutex;
+      key_set                 wanted;
+   };
+
+   void tiled_image::tile_cache::insert(tile_key key, pixmap_ptr pm)
+   {
+      auto i = tiles.find(key);
+      if (i != tiles.end())
+      {
+         i->second.pm = pm;
+         lru.splice(lru.begin(), lru, i->second.pos);
+         return;
+      }
+
+      lru.push_front(key);
+      tiles[key] = { pm, lru.begin() };
+      while (tiles.size() > std::max(capacity, min_capacity))
+      {
+         tiles.erase(lru.back());
+         lru.pop_back();
+      }
+   }
+
+   tiled_image::tiled_image(tile_source_ptr source, std::size_t cache_size)
+    : _source(source)
+    , _cache(std::make_shared<tile_cache>())
+   {
+      _cache->capacity = std::max<std::size_t>(cache_size, 1);
+   }
+
+   tiled_image::tile_key tiled_image::make_key(int level, int col, int row)
+   {
+      return (tile_key(level) << 56) | (tile_key(col & 0xfffffff) << 28) | (row & 0xfffffff);
+   }
+
+   view_limits tiled_image::limits(basic_context const& /* ctx */) const
+   {
+      auto size_ = _source->size();
+      point size = { size_.x * _zoom, size_.y * _zoom };
+      return { size, size };
+   }
+
+   pixmap const* tiled_image::find_tile(tile_key key)
+   {
+      auto i = _cache->tiles.find(key);
+      if (i == _cache->tiles.end())
+         return nullptr;
+      _cache->lru.splice(_cache->lru.begin(), _cache->lru, i->second.pos);
+      return i->second.pm.get();
+   }
+
+   void tiled_image::request_tile(context const& ctx, int level, int col, int row)
+   {
+      auto key = make_key(level, col, row);
+      if (_cache->pending.count(key) || _cache->failed.count(key))
+         return;
+      _cache->pending.insert(key);
+
+      std::weak_ptr<tile_cache> weak_cache = _cache;
+      std::weak_ptr<element> weak_self = weak_from_this();
+      asio::post(tile_loader_pool(),
+         [source = _source, weak_cache, weak_self, key, level, col, row, &view_ = ctx.view]()
+         {
+            // Do not hold on to the cache while loading. If the element is
+            // gone, so is the cache, and the result will be dropped.
+            bool wanted = false;
+            if (auto cache = weak_cache.lock())
+            {
+               std::lock_guard<std::mutex> lock(cache->wanted_mutex);
+               wanted = cache->wanted.count(key) != 0;
+            }
+            else
+            {
+               return;
+            }
+
+            pixmap_ptr pm;
+            bool failed = false;
+            if (wanted)
+            {
+               try
+               {
+                  pm = source->load(level, col, row);
+                  failed = !pm;  // The source does not have it
+               }
+               catch (failed_to_load_pixmap const&)
+               {
+                  failed = true;
+               }
+            }
+
+            if (weak_cache.expired())
+               return;
+
+            view_.post(
+               [weak_cache, weak_self, key, pm, failed, &view_]()
+               {
+                  if (auto cache = weak_cache.lock())
+                  {
+                     cache->pending.erase(key);
+                     if (failed)
+                        cache->failed.insert(key);
+                     if (pm)
+                     {
+                        cache->insert(key, pm);
+                        if (auto self = weak_self.lock())
+                           view_.refresh(*self);
+                     }
+                  }
+               }
+            );
+         }
+      );
+   }
+
+   bool tiled_image::draw_tile(
+      context const& ctx, int level, int col, int row, rect dest, int max_level
+   )
+   {
+      // Try the tile itself first, then fall back to the portion of the
+      // closest coarser tile that we have.
+      auto  ts = _source->tile_size();
+      auto  size_ = _source->size();
+      for (int l = level; l <= max_level; ++l)
+      {
+         int   shift = l - level;
+         auto  pm = find_tile(make_key(l, col >> shift, row >> shift));
+         if (!pm)
+            continue;
+
+         // The tile's area in level-0 image pixels, clipped to the image
+         float div = float(1 << level);
+         rect  area = {
+            col * ts * div
+          , row * ts * div
+          , std::min((col + 1) * ts * div, size_.x)
+          , std::min((row + 1) * ts * div, size_.y)
+         };
+
+         // The same area in the source pixmap's coordinates
+         float pdiv = float(1 << l);
+         float px = (col >> shift) * ts * pdiv;
+         float py = (row >> shift) * ts * pdiv;
+         rect  src = {
+            (area.left - px) / pdiv
+          , (area.top - py) / pdiv
+          , (area.right - px) / pdiv
+          , (area.bottom - py) / pdiv
+         };
+
+         // Do not sample beyond the pixmap's edges
+         auto pm_size = pm->size();
+         src.right = std::min(src.right, pm_size.x);
+         src.bottom = std::min(src.bottom, pm_size.y);
+         if (src.width() <= 0 || src.height() <= 0)
+            return false;
+
+         ctx.canvas.draw(*pm, src, dest);
+         return l == level;
+      }
+      return false;
+   }
+
+   void tiled_image::draw(context const& ctx)
+   {
+      auto& cnv = ctx.canvas;
+      auto  clip_extent = cnv.clip_extent();
+      if (!intersects(ctx.bounds, clip_extent) || _zoom <= 0)
+         return;
+
+      // Pick the coarsest level whose pixels are still at least as fine as
+      // the device pixels.
+      auto  dev = cnv.user_to_device({ 1, 1 });
+      float pixel_size = std::abs(dev.x) * cnv.pre_scale() * _zoom;
+      int   max_level = _source->num_levels() - 1;
+      int   level = 0;
+      while (level < max_level && pixel_size * (1 << (level + 1)) <= 1.0f)
+         ++level;
+
+      auto  visible = min(ctx.bounds, clip_extent);
+      auto  ts = _source->tile_size();
+      auto  level_size = _source->level_size(level);
+      int   cols = std::ceil(level_size.x / ts);
+      int   rows = std::ceil(level_size.y / ts);
+      float tile_extent = ts * float(1 << level) * _zoom;   // in user space
+      auto  origin = ctx.bounds.top_left();
+
+      int   col_start = std::max(0, int((visible.left - origin.x) / tile_extent));
+      int   col_end = std::min(cols, int(std::ceil((visible.right - origin.x) / tile_extent)));
+      int   row_start = std::max(0, int((visible.top - origin.y) / tile_extent));
+      int   row_end = std::min(rows, int(std::ceil((visible.bottom - origin.y) / tile_extent)));
+
+      _cache->min_capacity =
+         std::size_t(std::max(0, row_end - row_start)) * std::max(0, col_end - col_start);
+
+      {
+         std::lock_guard<std::mutex> lock(_cache->wanted_mutex);
+         _cache->wanted.clear();
+         for (int row = row_start; row < row_end; ++row)
+            for (int col = col_start; col < col_end; ++col)
+               _cache->wanted.insert(make_key(level, col, row));
+      }
+
+      auto  size_ = _source->size();
+      for (int row = row_start; row < row_end; ++row)
+      {
+         for (int col = col_start; col < col_end; ++col)
+         {
+            rect dest = {
+               origin.x + col * tile_extent
+             , origin.y + row * tile_extent
+             , origin.x + std::min((col + 1) * tile_extent, size_.x * _zoom)
+             , origin.y + std::min((row + 1) * tile_extent, size_.y * _zoom)
+            };
+
+            if (!draw_tile(ctx, level, col, row, dest, max_level))
+               request_tile(ctx, level, col, row);
+         }
+      }
+   }
+}}
@@ -6,7 +6,15 @@
 #include <elements/support/canvas.hpp>
 #include <cairo.h>
 
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 
 namespace cycfi { namespace elements
 {
@@ -298,13 +306,129 @@ namespace cycfi { namespace elements
 
    namespace
    {
-      point get_text_start(cairo_t& _context, point p, int align, char const* utf8)
+      ////////////////////////////////////////////////////////////////////////
+      // Shaping the same labels over and over, on each draw and on each
+      // limits query, is wasteful. We keep an LRU cache of shaped glyph
+      // runs and their extents, keyed by scaled font (the font face, size
+      // and transform) and text.
+      ////////////////////////////////////////////////////////////////////////
+      struct shaped_run
       {
+                              shaped_run(cairo_scaled_font_t* font_, char const* utf8);
+                              ~shaped_run();
+                              shaped_run(shaped_run const&) = delete;
+         shaped_run&          operator=(shaped_run const&) = delete;
+
+         cairo_scaled_font_t* font;
+         std::string          text;
+         cairo_glyph_t*       glyphs = nullptr;
+         int                  num_glyphs = 0;
          cairo_text_extents_t extents;
-         cairo_text_extents(&_context, utf8, &extents);
+      };
+
+      using shaped_run_ptr = std::shared_ptr<shaped_run const>;
+
+      shaped_run::shaped_run(cairo_scaled_font_t* font_, char const* utf8)
+       : font(cairo_scaled_font_reference(font_))
+       , text(utf8)
+      {
+         auto stat = cairo_scaled_font_text_to_glyphs(
+            font, 0, 0, text.data(), int(text.size()),
+            &glyphs, &num_glyphs, nullptr, nullptr, nullptr);
+
+         if (stat != CAIRO_STATUS_SUCCESS)
+         {
+            glyphs = nullptr;
+            num_glyphs = 0;
+         }
+         cairo_scaled_font_glyph_extents(font, glyphs, num_glyphs, &extents);
+      }
+
+      shaped_run::~shaped_run()
+      {
+         if (glyphs)
+            cairo_glyph_free(glyphs);
+         cairo_scaled_font_destroy(font);
+      }
+
+      class shaped_run_cache
+      {
+      public:
+
+         static constexpr std::size_t capacity = 1024;
+         static constexpr std::size_t max_text_size = 1024;
+
+         shaped_run_ptr       get(cairo_scaled_font_t* font, char const* utf8);
+
+      private:
+
+         // The key's text refers to the run's own copy
+         struct key
+         {
+            cairo_scaled_font_t* font;
+            std::string_view     text;
+
+            bool operator==(key const& rhs) const
+            {
+               return font == rhs.font && text == rhs.text;
+            }
+         };
+
+         struct key_hash
+         {
+            std::size_t operator()(key const& k) const
+            {
+               auto h = std::hash<std::string_view>{}(k.text);
+               return h ^ (std::hash<void*>{}(k.font) + 0x9e3779b9 + (h << 6) + (h >> 2));
+            }
+         };
+
+         using run_list = std::list<shaped_run_ptr>;
+
+         std::mutex           _mutex;
+         run_list             _runs;
+         std::unordered_map<key, run_list::iterator, key_hash> _map;
+      };
+
+      shaped_run_ptr shaped_run_cache::get(cairo_scaled_font_t* font, char const* utf8)
+      {
+         // Do not bother caching very long texts
+         auto len = std::strlen(utf8);
+         if (len > max_text_size)
+            return std::make_shared<shaped_run const>(font, utf8);
+
+         std::lock_guard<std::mutex> lock(_mutex);
+         auto i = _map.find(key{ font, { utf8, len } });
+         if (i != _map.end())
+         {
+            _runs.splice(_runs.begin(), _runs, i->second);
+            return *i->second;
+         }
+
+         auto run = std::make_shared<shaped_run const>(font, utf8);
+         _runs.push_front(run);
+         _map[key{ font, run->text }] = _runs.begin();
+         if (_runs.size() > capacity)
+         {
+            auto const& last = _runs.back();
+            _map.erase(key{ last->font, last->text });
+            _runs.pop_back();
+         }
+         return run;
+      }
+
+      shaped_run_ptr get_shaped_run(cairo_t& context, char const* utf8)
+      {
+         static shaped_run_cache cache;
+         return cache.get(cairo_get_scaled_font(&context), utf8);
+      }
+
+      point get_text_start(point p, int align, shaped_run const& run)
+      {
+         auto const& extents = run.extents;
 
          cairo_font_extents_t font_extents;
-         cairo_scaled_font_extents(cairo_get_scaled_font(&_context), &font_extents);
+         cairo_scaled_font_extents(run.font, &font_extents);
 
          switch (align & 0x3)
          {
@@ -343,27 +467,35 @@ namespace cycfi { namespace elements
    void canvas::fill_text(point p, char const* utf8)
    {
       apply_fill_style();
-      p = get_text_start(_context, p, _state.align, utf8);
-      cairo_move_to(&_context, p.x, p.y);
-      cairo_show_text(&_context, utf8);
+      auto run = get_shaped_run(_context, utf8);
+      p = get_text_start(p, _state.align, *run);
+      cairo_matrix_t mat;
+      cairo_get_matrix(&_context, &mat);
+      cairo_translate(&_context, p.x, p.y);
+      cairo_show_glyphs(&_context, run->glyphs, run->num_glyphs);
+      cairo_set_matrix(&_context, &mat);
    }
 
    void canvas::stroke_text(point p, char const* utf8)
    {
       apply_stroke_style();
-      p = get_text_start(_context, p, _state.align, utf8);
-      cairo_move_to(&_context, p.x, p.y);
-      cairo_text_path(&_context, utf8);
+      auto run = get_shaped_run(_context, utf8);
+      p = get_text_start(p, _state.align, *run);
+      cairo_matrix_t mat;
+      cairo_get_matrix(&_context, &mat);
+      cairo_translate(&_context, p.x, p.y);
+      cairo_glyph_path(&_context, run->glyphs, run->num_glyphs);
+      cairo_set_matrix(&_context, &mat);
       stroke();
    }
 
    canvas::text_metrics canvas::measure_text(char const* utf8)
    {
-      cairo_text_extents_t extents;
-      cairo_text_extents(&_context, utf8, &extents);
+      auto run = get_shaped_run(_context, utf8);
+      auto const& extents = run->extents;
 
       cairo_font_extents_t font_extents;
-      cairo_scaled_font_extents(cairo_get_scaled_font(&_context), &font_extents);
+      cairo_scaled_font_extents(run->font, &font_extents);
 
       return {
          /*ascent=*/    float(font_extents.ascent),
@@ -373,17 +505,136 @@ namespace cycfi { namespace elements
       };
    }
 
+   namespace
+   {
+      // Returns true if the pixels of the surface, with its origin placed at
+      // origin (in user space), fall exactly on device pixels, one-to-one.
+      bool is_pixel_aligned(cairo_t& context, cairo_surface_t* surface, point origin)
+      {
+         cairo_matrix_t mat;
+         cairo_get_matrix(&context, &mat);
+         if (mat.xy != 0 || mat.yx != 0)
+            return false;
+
+         double tsx, tsy, tox, toy, psx, psy;
+         auto target = cairo_get_group_target(&context);
+         cairo_surface_get_device_scale(target, &tsx, &tsy);
+         cairo_surface_get_device_offset(target, &tox, &toy);
+         cairo_surface_get_device_scale(surface, &psx, &psy);
+
+         auto close_to = [](double a, double b) { return std::abs(a - b) < 1e-4; };
+         auto x = (mat.xx * origin.x + mat.x0) * tsx + tox;
+         auto y = (mat.yy * origin.y + mat.y0) * tsy + toy;
+
+         return close_to(mat.xx * tsx, psx) && close_to(mat.yy * tsy, psy)
+            && close_to(x, std::round(x)) && close_to(y, std::round(y));
+      }
+   }
+
    void canvas::draw(pixmap const& pm, elements::rect src, elements::rect dest)
    {
+      if (is_same_size(src, dest)
+         && cairo_image_surface_get_format(pm._surface) != CAIRO_FORMAT_A8)
+      {
+         blit b{ src, dest };
+         draw_many(pm, &b, 1);
+         return;
+      }
+
       auto  state = new_state();
       auto  w = dest.width();
       auto  h = dest.height();
       translate(dest.top_left());
       auto scale_ = point{ w/src.width(), h/src.height() };
       scale(scale_);
-      cairo_set_source_surface(&_context, pm._surface, -src.left, -src.top);
       rect({ 0, 0, w/scale_.x, h/scale_.y });
-      cairo_fill(&_context);
+
+      switch (cairo_image_surface_get_format(pm._surface))
+      {
+         case CAIRO_FORMAT_A8:
+         {
+            // Masks are painted with the current fill style
+            apply_fill_style();
+            cairo_clip(&_context);
+            cairo_mask_surface(&_context, pm._surface, -src.left, -src.top);
+            break;
+         }
+
+         case CAIRO_FORMAT_RGB24:
+         {
+            // Opaque images do not need blending. Pad the edges so that
+            // filtering near the borders does not sample transparent
+            // pixels, which would otherwise be copied as-is.
+            cairo_set_source_surface(&_context, pm._surface, -src.left, -src.top);
+            cairo_pattern_set_extend(cairo_get_source(&_context), CAIRO_EXTEND_PAD);
+            cairo_set_operator(&_context, CAIRO_OPERATOR_SOURCE);
+            cairo_fill(&_context);
+            break;
+         }
+
+         default:
+         {
+            cairo_set_source_surface(&_context, pm._surface, -src.left, -src.top);
+            cairo_fill(&_context);
+            break;
+         }
+      }
+   }
+
+   void canvas::draw_many(pixmap const& pm, blit const* blits, std::size_t count)
+   {
+      auto format = cairo_image_surface_get_format(pm._surface);
+      if (format == CAIRO_FORMAT_A8)
+      {
+         // Masks need clipping; take the general path.
+         for (std::size_t i = 0; i != count; ++i)
+            draw(pm, blits[i].src, blits[i].dest);
+         return;
+      }
+
+      // Unscaled blits do not need any transforms, so instead of a full
+      // save/restore, we just swap the source pattern (and operator) and
+      // put them back when we're done. Pixel-aligned blits use the nearest
+      // filter, which is both exact and the cheapest to sample.
+      bool  opaque = format == CAIRO_FORMAT_RGB24;
+      auto  save_source = cairo_pattern_reference(cairo_get_source(&_context));
+      auto  save_operator = cairo_get_operator(&_context);
+      auto  pattern = cairo_pattern_create_for_surface(pm._surface);
+      if (opaque)
+         cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+
+      for (std::size_t i = 0; i != count; ++i)
+      {
+         auto const& b = blits[i];
+         if (!is_same_size(b.src, b.dest))
+         {
+            cairo_set_operator(&_context, save_operator);
+            cairo_set_source(&_context, save_source);
+            draw(pm, b.src, b.dest);
+            continue;
+         }
+
+         auto origin = point{ b.dest.left - b.src.left, b.dest.top - b.src.top };
+         cairo_matrix_t mat;
+         cairo_matrix_init_translate(&mat, -origin.x, -origin.y);
+         cairo_pattern_set_matrix(pattern, &mat);
+         cairo_pattern_set_filter(
+            pattern
+          , is_pixel_aligned(_context, pm._surface, origin)?
+               CAIRO_FILTER_NEAREST : CAIRO_FILTER_GOOD
+         );
+
+         cairo_set_source(&_context, pattern);
+         if (opaque)
+            cairo_set_operator(&_context, CAIRO_OPERATOR_SOURCE);
+         rect(b.dest);
+         cairo_fill(&_context);
+      }
+
+      cairo_set_operator(&_context, save_operator);
+      cairo_set_source(&_context, save_source);
+      cairo_pattern_destroy(pattern);
+      cairo_pattern_destroy(save_source);
    }
 
    void canvas::save()
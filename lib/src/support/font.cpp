@@ -5,6 +5,7 @@
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
 #include <elements/support/font.hpp>
+#include <elements/support/resource_paths.hpp>
 #include <infra/assert.hpp>
 
 #include <cairo.h>
@@ -31,10 +32,19 @@
 # include <cairo-quartz.h>
 #endif
 
+#include <asio.hpp>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
 #include <map>
 #include <mutex>
 #include <memory>
+#include <shared_mutex>
+#include <set>
 #include <sstream>
+#include <tuple>
+#include <unordered_map>
 #include <algorithm>
 #include <vector>
 #include <utility>
@@ -320,6 +330,91 @@ namespace cycfi { namespace elements
          return { cairo_font_map_, cairo_font_map_mutex_ };
       }
 
+      ////////////////////////////////////////////////////////////////////////
+      // Memo table from font_descr to the resolved font face, so that
+      // constructing an already seen font is a single hash lookup. The
+      // table is split into shards, each with its own reader-writer lock,
+      // so concurrent lookups rarely contend. The faces are the same ones
+      // held by the cairo_font_map (each entry holds its own reference).
+      // Unresolved descriptors are memoized as nullptr.
+      ////////////////////////////////////////////////////////////////////////
+      class font_memo
+      {
+      public:
+
+         static constexpr std::size_t num_shards = 16;
+
+                                    ~font_memo();
+
+         static std::string         key(font_descr const& descr);
+         bool                       find(std::string const& key, cairo_font_face_t*& face);
+         void                       insert(std::string const& key, cairo_font_face_t* face);
+
+      private:
+
+         using map_type = std::unordered_map<std::string, cairo_font_face_t*>;
+
+         struct shard
+         {
+            std::shared_mutex       mutex;
+            map_type                map;
+         };
+
+         shard&                     get_shard(std::string const& key);
+
+         shard                      _shards[num_shards];
+      };
+
+      font_memo::~font_memo()
+      {
+         for (auto& shard_ : _shards)
+         {
+            for (auto [key, face] : shard_.map)
+               if (face)
+                  cairo_font_face_destroy(face);
+         }
+      }
+
+      std::string font_memo::key(font_descr const& descr)
+      {
+         std::string k{ descr._families.begin(), descr._families.end() };
+         k += '\0';
+         k += char(descr._weight);
+         k += char(descr._slant);
+         k += char(descr._stretch);
+         return k;
+      }
+
+      font_memo::shard& font_memo::get_shard(std::string const& key)
+      {
+         return _shards[std::hash<std::string>{}(key) % num_shards];
+      }
+
+      bool font_memo::find(std::string const& key, cairo_font_face_t*& face)
+      {
+         auto& shard_ = get_shard(key);
+         std::shared_lock<std::shared_mutex> lock(shard_.mutex);
+         auto i = shard_.map.find(key);
+         if (i == shard_.map.end())
+            return false;
+         face = i->second? cairo_font_face_reference(i->second) : nullptr;
+         return true;
+      }
+
+      void font_memo::insert(std::string const& key, cairo_font_face_t* face)
+      {
+         auto& shard_ = get_shard(key);
+         std::unique_lock<std::shared_mutex> lock(shard_.mutex);
+         if (shard_.map.find(key) == shard_.map.end())
+            shard_.map[key] = face? cairo_font_face_reference(face) : nullptr;
+      }
+
+      font_memo& get_font_memo()
+      {
+         static font_memo memo;
+         return memo;
+      }
+
       int map_fc_weight(int w)
       {
          enum
@@ -366,10 +461,11 @@ namespace cycfi { namespace elements
       struct font_entry
       {
          font_entry(FcPattern* pat, FcChar8 const* full_name, FcChar8 const* file)
-         : pattern(fc::pattern_shallow_copy_tag{}, *pat)
-         , full_name(reinterpret_cast<char const*>(full_name))
+         : full_name(reinterpret_cast<char const*>(full_name))
          , file(reinterpret_cast<char const*>(file))
          {
+            fc::pattern pattern(fc::pattern_shallow_copy_tag{}, *pat);
+
             if (auto w = pattern.get_weight(); w)
                weight = map_fc_weight(*w); // map the weight (normalized 0 to 100)
             else
@@ -386,7 +482,17 @@ namespace cycfi { namespace elements
                stretch = font_constants::stretch_normal;
          }
 
-         fc::pattern pattern;
+         font_entry(
+            std::string full_name, std::string file
+          , std::uint8_t weight, std::uint8_t slant, std::uint8_t stretch
+         )
+         : full_name(std::move(full_name))
+         , file(std::move(file))
+         , weight(weight)
+         , slant(slant)
+         , stretch(stretch)
+         {}
+
          std::string full_name;
          std::string file;
          std::uint8_t weight;
@@ -394,14 +500,23 @@ namespace cycfi { namespace elements
          std::uint8_t stretch;
       };
 
+      // The fonts we know about, by family. Families are looked up lazily,
+      // as they are requested. An empty vector means there is no such
+      // family.
       using font_map_type = std::map<std::string, std::vector<font_entry>>;
-      font_map_type& font_map()
+
+      std::pair<font_map_type&, std::mutex&> get_font_map()
       {
          static font_map_type font_map_;
-         return font_map_;
+         static std::mutex font_map_mutex_;
+         return { font_map_, font_map_mutex_ };
       }
 
-      void init_font_map()
+      // True if the font map has families that the index does not have yet.
+      // Guarded by the font map mutex.
+      bool font_index_dirty = false;
+
+      fc::config& add_app_font_dirs(fc::config& conf)
       {
          std::vector<fs::path> paths = font_paths();
 
@@ -416,47 +531,270 @@ namespace cycfi { namespace elements
          paths.push_back(fs::path(windir) / "fonts");
 #endif
 #endif
-         fc::config& conf = fc::instance();
-
          for (auto& path : paths)
             conf.app_font_add_dir(reinterpret_cast<FcChar8 const*>(path.generic_string().c_str()));
+         return conf;
+      }
+
+      fc::config& init_font_config()
+      {
+         // Thread safe: this is reached from the font index writer too,
+         // outside the font map lock.
+         static fc::config& conf = add_app_font_dirs(fc::instance());
+         return conf;
+      }
+
+      // Query fontconfig for the faces of a single family, rather than
+      // listing all the fonts installed in the system.
+      std::vector<font_entry> query_family(std::string const& family)
+      {
+         fc::config& conf = init_font_config();
 
          fc::pattern pat(fc::pattern_empty_tag{});
+         FcPatternAddString(
+            pat.handle(), FC_FAMILY, reinterpret_cast<FcChar8 const*>(family.c_str()));
          fc::object_set os(FC_FAMILY, FC_FULLNAME, FC_WIDTH, FC_WEIGHT, FC_SLANT, FC_FILE);
-         fc::font_set_ptr fs = fc::font_list(conf.get(), pat, os);
+         fc::font_set_ptr font_set = fc::font_list(conf.get(), pat, os);
 
-         for (int i = 0; i < fs->nfont; ++i)
+         std::vector<font_entry> entries;
+         for (int i = 0; i < font_set->nfont; ++i)
          {
-            FcPattern* font = fs->fonts[i];
-            FcChar8 *file, *family, *full_name;
+            FcPattern* font = font_set->fonts[i];
+            FcChar8 *file, *family_, *full_name;
             if (FcPatternGetString(font, FC_FILE, 0, &file) == FcResultMatch &&
-               FcPatternGetString(font, FC_FAMILY, 0, &family) == FcResultMatch &&
+               FcPatternGetString(font, FC_FAMILY, 0, &family_) == FcResultMatch &&
                FcPatternGetString(font, FC_FULLNAME, 0, &full_name) == FcResultMatch
             )
             {
-               std::string key = reinterpret_cast<char const*>(family);
+               // fontconfig matches families loosely. We want the faces
+               // whose (primary) family is exactly the one requested.
+               std::string key = reinterpret_cast<char const*>(family_);
                trim(key);
+               if (key == family)
+                  entries.push_back(font_entry(font, full_name, file));
+            }
+         }
+         return entries;
+      }
+
+      ////////////////////////////////////////////////////////////////////////
+      // Persistent font index. A text file that maps families to their
+      // faces (full name, file, weight, slant and stretch), along with the
+      // application font paths and the font directories (with their
+      // modification times) it was built from. The index is valid for as
+      // long as none of these change.
+      ////////////////////////////////////////////////////////////////////////
+      constexpr char const* font_index_magic = "elements-font-index 1";
+
+      std::pair<fs::path&, std::mutex&> get_font_index_path()
+      {
+         static fs::path index_path;
+         static std::mutex index_path_mutex;
+         return { index_path, index_path_mutex };
+      }
+
+      fs::path font_index_file()
+      {
+         auto [index_path, index_path_mutex] = get_font_index_path();
+         std::lock_guard<std::mutex> guard(index_path_mutex);
+         return index_path;
+      }
+
+      long long modified_time(fs::path const& path)
+      {
+         std::error_code ec;
+         auto time = fs::last_write_time(path, ec);
+         return ec ? -1 : static_cast<long long>(time.time_since_epoch().count());
+      }
+
+      std::vector<std::string> font_dirs()
+      {
+         std::vector<std::string> dirs;
+         if (auto list = FcConfigGetFontDirs(init_font_config().get()))
+         {
+            while (FcChar8* dir = FcStrListNext(list))
+               dirs.push_back(reinterpret_cast<char const*>(dir));
+            FcStrListDone(list);
+         }
+         return dirs;
+      }
+
+      std::vector<std::string> split_fields(std::string const& line)
+      {
+         std::vector<std::string> fields;
+         std::istringstream str(line);
+         std::string field;
+         while (getline(str, field, '\t'))
+            fields.push_back(field);
+         return fields;
+      }
+
+      bool parse_byte(std::string const& field, std::uint8_t& result)
+      {
+         char* end = nullptr;
+         errno = 0;
+         long val = std::strtol(field.c_str(), &end, 10);
+         if (field.empty() || *end != '\0' || errno != 0 || val < 0 || val > 255)
+            return false;
+         result = std::uint8_t(val);
+         return true;
+      }
+
+      void load_font_index(font_map_type& map)
+      {
+         auto file = font_index_file();
+         if (file.empty())
+            return;
+
+         std::ifstream in(file);
+         std::string line;
+         if (!in || !getline(in, line) || line != font_index_magic)
+            return;
+
+         font_map_type families;
+         std::vector<std::string> paths;
+         std::vector<font_entry>* faces = nullptr;
+         while (getline(in, line))
+         {
+            auto fields = split_fields(line);
+            if (fields.empty())
+               continue;
+
+            if (fields[0] == "path" && fields.size() == 2)
+            {
+               paths.push_back(fields[1]);
+            }
+            else if (fields[0] == "dir" && fields.size() == 3)
+            {
+               // Stale index?
+               if (std::to_string(modified_time(fields[2])) != fields[1])
+                  return;
+            }
+            else if (fields[0] == "family" && fields.size() == 2)
+            {
+               faces = &families[fields[1]];
+            }
+            else if (fields[0] == "face" && fields.size() == 6 && faces)
+            {
+               std::uint8_t weight, slant, stretch;
+               if (!parse_byte(fields[1], weight)
+                  || !parse_byte(fields[2], slant)
+                  || !parse_byte(fields[3], stretch))
+                  return;  // Corrupt index
+               faces->push_back(font_entry(fields[4], fields[5], weight, slant, stretch));
+            }
+            else
+            {
+               return;  // Corrupt index
+            }
+         }
+
+         // The application font paths must be the same
+         auto const& app_paths = font_paths();
+         if (paths.size() != app_paths.size())
+            return;
+         for (std::size_t i = 0; i != paths.size(); ++i)
+            if (paths[i] != app_paths[i].generic_string())
+               return;
+
+         map.insert(families.begin(), families.end());
+      }
+
+      void write_font_index(font_map_type const& map)
+      {
+         auto file = font_index_file();
+         if (file.empty())
+            return;
+
+         auto has_separators = [](std::string const& s)
+         {
+            return s.find_first_of("\t\n") != std::string::npos;
+         };
+
+         std::error_code ec;
+         fs::create_directories(file.parent_path(), ec);
+         auto temp = file;
+         temp += ".tmp";
+         {
+            std::ofstream out(temp, std::ios::trunc);
+            if (!out)
+               return;
 
-               font_map()[key].push_back(font_entry(font, full_name, file));
+            out << font_index_magic << '\n';
+            for (auto const& path : font_paths())
+               out << "path\t" << path.generic_string() << '\n';
+            for (auto const& dir : font_dirs())
+               out << "dir\t" << modified_time(dir) << '\t' << dir << '\n';
+            for (auto const& [family, faces] : map)
+            {
+               if (has_separators(family))
+                  continue;
+               out << "family\t" << family << '\n';
+               for (auto const& face : faces)
+               {
+                  if (has_separators(face.full_name) || has_separators(face.file))
+                     continue;
+                  out << "face\t"
+                     << int(face.weight) << '\t'
+                     << int(face.slant) << '\t'
+                     << int(face.stretch) << '\t'
+                     << face.full_name << '\t'
+                     << face.file << '\n';
+               }
+            }
+            if (!out)
+            {
+               out.close();
+               fs::remove(temp, ec);
+               return;
             }
          }
+         fs::rename(temp, file, ec);
+         if (ec)
+            fs::remove(temp, ec);
       }
 
-      font_entry const* match(font_descr descr)
+      std::vector<font_entry> const* find_family(std::string const& family)
       {
-         if (font_map().empty())
-            init_font_map();
+         auto [map, map_mutex] = get_font_map();
+         std::lock_guard<std::mutex> lock(map_mutex);
+
+         static bool index_loaded = false;
+         if (!index_loaded)
+         {
+            index_loaded = true;
+            load_font_index(map);
+         }
 
+         auto i = map.find(family);
+         if (i == map.end())
+         {
+            i = map.emplace(family, query_family(family)).first;
+            font_index_dirty = true;
+
+            // Write the index once, at exit, if not flushed before. This
+            // is destroyed before the font map (constructed after it).
+            struct index_saver
+            {
+               ~index_saver() { flush_font_index(); }
+            };
+            static index_saver saver;
+         }
+         return &i->second;
+      }
+
+      font_entry const* match(font_descr descr)
+      {
          std::istringstream str(std::string{ descr._families });
          std::string family;
          while (getline(str, family, ','))
          {
             trim(family);
-            if (auto i = font_map().find(family); i != font_map().end())
+            auto const& faces = *find_family(family);
             {
                int min = 10000;
-               std::vector<font_entry>::const_iterator best_match = i->second.end();
-               for (auto j = i->second.begin(); j != i->second.end(); ++j)
+               std::vector<font_entry>::const_iterator best_match = faces.end();
+               for (auto j = faces.begin(); j != faces.end(); ++j)
                {
                   auto const& item = *j;
 
@@ -474,7 +812,7 @@ namespace cycfi { namespace elements
                      best_match = j;
                   }
                }
-               if (best_match != i->second.end())
+               if (best_match != faces.end())
                   return &*best_match;
             }
          }
@@ -628,12 +966,49 @@ namespace cycfi { namespace elements
       return _paths;
    }
 
+   void enable_font_index(fs::path const& path)
+   {
+      auto file = path.empty()?
+         app_data_path() / "elements" / "font_index" : path;
+
+      auto [index_path, index_path_mutex] = get_font_index_path();
+      std::lock_guard<std::mutex> guard(index_path_mutex);
+      index_path = file;
+   }
+
+   void disable_font_index()
+   {
+      auto [index_path, index_path_mutex] = get_font_index_path();
+      std::lock_guard<std::mutex> guard(index_path_mutex);
+      index_path.clear();
+   }
+
+   void flush_font_index()
+   {
+      // Take a snapshot of the font map, and write it outside the lock
+      font_map_type snapshot;
+      {
+         auto [map, map_mutex] = get_font_map();
+         std::lock_guard<std::mutex> lock(map_mutex);
+         if (!font_index_dirty)
+            return;
+         font_index_dirty = false;
+         snapshot = map;
+      }
+      write_font_index(snapshot);
+   }
+
    font::font(font_descr descr)
    {
 #ifndef __APPLE__
       static free_type_library ft_lib;
 #endif
 
+      auto& memo = get_font_memo();
+      auto key = font_memo::key(descr);
+      if (memo.find(key, _handle))
+         return;
+
       auto match_ptr = match(descr);
       if (match_ptr)
       {
@@ -670,6 +1045,7 @@ namespace cycfi { namespace elements
       {
          _handle = nullptr;
       }
+      memo.insert(key, _handle);
    }
 
    font::font(font const& rhs)
@@ -700,6 +1076,81 @@ namespace cycfi { namespace elements
       if (_handle)
          cairo_font_face_destroy(_handle);
    }
-}}
 
+   namespace
+   {
+      asio::thread_pool& glyph_warmup_pool()
+      {
+         static asio::thread_pool pool{ 1 };
+         return pool;
+      }
 
+      // Rasterize the glyphs of warmup, one at a time, into a scratch
+      // image surface with the default font options. cairo keys scaled
+      // fonts on the font options too, so the glyph cache warmed here is
+      // the one used by image surfaces drawing with default options only.
+      // Other backends (e.g. xlib or quartz) rasterize glyphs on their own
+      // side; for those, this only loads the face and its font file ahead
+      // of time.
+      void render_glyphs(glyph_warmup const& warmup, cairo_font_face_t* face, float scale)
+      {
+         auto extent_ = int(std::ceil(warmup.size * scale * 2)) + 1;
+         auto surface_ = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, extent_, extent_);
+         auto context_ = cairo_create(surface_);
+         cairo_scale(context_, scale, scale);
+         cairo_set_font_face(context_, face);
+         cairo_set_font_size(context_, warmup.size);
+
+         auto scaled_font = cairo_get_scaled_font(context_);
+         cairo_glyph_t* glyphs = nullptr;
+         int num_glyphs = 0;
+         auto stat = cairo_scaled_font_text_to_glyphs(
+            scaled_font, 0, 0, warmup.chars.data(), int(warmup.chars.size()),
+            &glyphs, &num_glyphs, nullptr, nullptr, nullptr
+         );
+
+         if (stat == CAIRO_STATUS_SUCCESS)
+         {
+            for (int i = 0; i != num_glyphs; ++i)
+            {
+               cairo_glyph_t glyph = { glyphs[i].index, 0, warmup.size };
+               cairo_show_glyphs(context_, &glyph, 1);
+            }
+            cairo_glyph_free(glyphs);
+         }
+
+         cairo_destroy(context_);
+         cairo_surface_destroy(surface_);
+      }
+   }
+
+   void warm_up_glyphs(glyph_warmup const& warmup, float scale)
+   {
+      if (!warmup.typeface._handle || warmup.chars.empty() || warmup.size <= 0)
+         return;
+
+      // Skip requests that were already made
+      {
+         using key_type = std::tuple<cairo_font_face_t*, float, float, std::string>;
+         static std::set<key_type> requested;
+         static std::mutex requested_mutex;
+
+         std::lock_guard<std::mutex> lock(requested_mutex);
+         if (!requested.emplace(warmup.typeface._handle, warmup.size, scale, warmup.chars).second)
+            return;
+      }
+
+      asio::post(glyph_warmup_pool(),
+         [warmup, scale]()
+         {
+            render_glyphs(warmup, warmup.typeface._handle, scale);
+         }
+      );
+   }
+
+   void warm_up_glyphs(std::vector<glyph_warmup> const& warmups, float scale)
+   {
+      for (auto const& warmup : warmups)
+         warm_up_glyphs(warmup, scale);
+   }
+}}
@@ -5,10 +5,15 @@
 =============================================================================*/
 #include <elements/support/glyphs.hpp>
 #include <elements/support/detail/scratch_context.hpp>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 
 namespace cycfi { namespace elements
 {
-   static detail::scratch_context scratch_context_;
+   // Each thread gets its own scratch context, so glyphs may be shaped on
+   // worker threads (see static_text_box's async layout).
+   static thread_local detail::scratch_context scratch_context_;
 
    glyphs::glyphs(char const* first, char const* last)
     : _first(first)
@@ -29,11 +34,20 @@ namespace cycfi { namespace elements
     , _last(last)
     , _scaled_font(master._scaled_font)
     , _glyphs(master._glyphs + glyph_start)
+    , _advances(master._advances + glyph_start)
     , _glyph_count(glyph_end - glyph_start)
     , _clusters(master._clusters + cluster_start)
     , _cluster_count(cluster_end - cluster_start)
     , _clusterflags(master._clusterflags)
    {
+      if (!master._breaks.glyph.empty())
+      {
+         _cluster_glyphs = master._breaks.glyph.data() + cluster_start;
+         _cluster_bytes = master._breaks.byte.data() + cluster_start;
+         _glyph_base = glyph_start;
+         _byte_base = int(first - master._first);
+      }
+
       CYCFI_ASSERT(_first, "Precondition failure: _first must not be null");
       CYCFI_ASSERT(_last, "Precondition failure: _last must not be null");
       CYCFI_ASSERT(_scaled_font, "Precondition failure: _scaled_font must not be null");
@@ -54,6 +68,7 @@ namespace cycfi { namespace elements
          unsigned state = 0;
 
          cairo_text_cluster_t* cluster = _clusters;
+         char const* first = _first;
          for (auto i = _first; i != _last; ++i)
          {
             if (!decode_utf8(state, codepoint, uint8_t(*i)))
@@ -62,6 +77,7 @@ namespace cycfi { namespace elements
                   break;
                glyph_index += cluster->num_glyphs;
                ++cluster;
+               first = i + 1;
             }
          }
 
@@ -69,9 +85,17 @@ namespace cycfi { namespace elements
 
          _glyph_count -= glyph_index;
          _glyphs += glyph_index;
+         _advances += glyph_index;
          _cluster_count -= clusters_skipped;
          _clusters = cluster;
-         _first += clusters_skipped;
+         if (_cluster_glyphs)
+         {
+            _cluster_glyphs += clusters_skipped;
+            _cluster_bytes += clusters_skipped;
+            _glyph_base += glyph_index;
+            _byte_base += int(first - _first);
+         }
+         _first = first;
       };
 
       if (strip_leading_spaces)
@@ -103,6 +127,64 @@ namespace cycfi { namespace elements
       );
    }
 
+   bool glyphs::cluster_range(char const* first, char const* last, int& c1, int& c2) const
+   {
+      if (_first == _last || !_cluster_glyphs || _cluster_count == 0)
+         return false;
+
+      auto  find = [this](char const* p)
+      {
+         int target = _byte_base + int(p - _first);
+         return int(std::lower_bound(
+            _cluster_bytes, _cluster_bytes + _cluster_count, target) - _cluster_bytes);
+      };
+
+      c1 = find(std::max(first, _first));
+      c2 = find(std::min(last, _last));
+      return c1 < c2;
+   }
+
+   void glyphs::draw(point pos, canvas& canvas_, char const* first, char const* last)
+   {
+      int c1, c2;
+      if (!cluster_range(first, last, c1, c2))
+         return;
+
+      int   g1 = _cluster_glyphs[c1] - _glyph_base;
+      int   g2 = (c2 < _cluster_count)? _cluster_glyphs[c2] - _glyph_base : _glyph_count;
+      auto  b1 = _first + (_cluster_bytes[c1] - _byte_base);
+      auto  b2 = (c2 < _cluster_count)? _first + (_cluster_bytes[c2] - _byte_base) : _last;
+
+      auto cr = &canvas_.cairo_context();
+      auto state = canvas_.new_state();
+
+      cairo_set_scaled_font(cr, _scaled_font);
+      cairo_translate(cr, pos.x - _glyphs->x, pos.y - _glyphs->y);
+      canvas_.apply_fill_style();
+
+      cairo_show_text_glyphs(
+         cr, b1, int(b2 - b1),
+         _glyphs + g1, g2 - g1,
+         _clusters + c1, c2 - c1, _clusterflags
+      );
+   }
+
+   bool glyphs::extent(char const* first, char const* last, float& left, float& right) const
+   {
+      int c1, c2;
+      if (!cluster_range(first, last, c1, c2))
+         return false;
+
+      int   g1 = _cluster_glyphs[c1] - _glyph_base;
+      int   g2 = (c2 < _cluster_count)? _cluster_glyphs[c2] - _glyph_base : _glyph_count;
+      if (g1 >= g2)
+         return false;
+
+      left = _glyphs[g1].x - _glyphs->x;
+      right = (_glyphs[g2 - 1].x + _advances[g2 - 1]) - _glyphs->x;
+      return true;
+   }
+
    float glyphs::width() const
    {
       if (_first == _last)
@@ -114,14 +196,99 @@ namespace cycfi { namespace elements
 
       if (_glyph_count)
       {
-         cairo_text_extents_t extents;
          auto glyph = _glyphs + _glyph_count -1;
-         cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
-         return (glyph->x + extents.x_advance) - _glyphs->x;
+         return (glyph->x + _advances[_glyph_count -1]) - _glyphs->x;
       }
       return 0;
    }
 
+   char const* glyphs::glyph_at(float x) const
+   {
+      if (_first == _last || _cluster_count == 0)
+         return nullptr;
+
+      auto  start_x = _glyphs->x;
+      auto  left = [&](int i)
+      {
+         return _glyphs[_cluster_glyphs[i] - _glyph_base].x - start_x;
+      };
+
+      if (!_cluster_glyphs)
+      {
+         char const* found = nullptr;
+         const_cast<glyphs*>(this)->for_each(
+            [x, &found](char const* utf8, float left, float right)
+            {
+               if (x >= left && x < right)
+               {
+                  found = utf8;
+                  return false;
+               }
+               return true;
+            }
+         );
+         return found;
+      }
+
+      // The last cluster that starts at or before x
+      int lo = 0, hi = _cluster_count;
+      while (lo < hi)
+      {
+         int mid = lo + (hi - lo) / 2;
+         if (left(mid) <= x)
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+      if (lo == 0)
+         return nullptr;
+
+      int   i = lo - 1;
+      int   g = _cluster_glyphs[i] - _glyph_base;
+      if (g >= _glyph_count || x < left(i) || x >= left(i) + _advances[g])
+         return nullptr;
+      return _first + (_cluster_bytes[i] - _byte_base);
+   }
+
+   char const* glyphs::glyph_bounds(char const* utf8, float& left, float& right) const
+   {
+      if (_first == _last || _cluster_count == 0)
+         return nullptr;
+
+      if (!_cluster_glyphs)
+      {
+         char const* found = nullptr;
+         const_cast<glyphs*>(this)->for_each(
+            [&](char const* utf8_, float left_, float right_)
+            {
+               if (utf8_ >= utf8)
+               {
+                  found = utf8_;
+                  left = left_;
+                  right = right_;
+                  return false;
+               }
+               return true;
+            }
+         );
+         return found;
+      }
+
+      // The first cluster that starts at or after utf8
+      int   target = _byte_base + int(utf8 - _first);
+      auto  i = int(std::lower_bound(
+         _cluster_bytes, _cluster_bytes + _cluster_count, target) - _cluster_bytes);
+      if (i == _cluster_count)
+         return nullptr;
+
+      int   g = _cluster_glyphs[i] - _glyph_base;
+      if (g >= _glyph_count)
+         return nullptr;
+      left = _glyphs[g].x - _glyphs->x;
+      right = left + _advances[g];
+      return _first + (_cluster_bytes[i] - _byte_base);
+   }
+
    glyphs::font_metrics glyphs::metrics() const
    {
       cairo_font_extents_t font_extents;
@@ -164,15 +331,19 @@ namespace cycfi { namespace elements
 
    master_glyphs::master_glyphs(master_glyphs&& rhs)
     : glyphs(rhs._first, rhs._last)
+    , _advance_buffer(std::move(rhs._advance_buffer))
+    , _breaks(std::move(rhs._breaks))
    {
       _scaled_font = rhs._scaled_font;
       _glyphs = rhs._glyphs;
+      _advances = _advance_buffer.data();
       _glyph_count = rhs._glyph_count;
       _clusters = rhs._clusters;
       _cluster_count = rhs._cluster_count;
       _clusterflags = rhs._clusterflags;
 
       rhs._glyphs = nullptr;
+      rhs._advances = nullptr;
       rhs._clusters = nullptr;
       rhs._scaled_font = nullptr;
    }
@@ -181,6 +352,14 @@ namespace cycfi { namespace elements
    {
       if (&rhs != this)
       {
+         // Release what we have before taking over rhs's resources
+         if (_glyphs)
+            cairo_glyph_free(_glyphs);
+         if (_clusters)
+            cairo_text_cluster_free(_clusters);
+         if (_scaled_font)
+            cairo_scaled_font_destroy(_scaled_font);
+
          _first = rhs._first;
          _last = rhs._last;
          _scaled_font = rhs._scaled_font;
@@ -189,8 +368,12 @@ namespace cycfi { namespace elements
          _clusters = rhs._clusters;
          _cluster_count = rhs._cluster_count;
          _clusterflags = rhs._clusterflags;
+         _advance_buffer = std::move(rhs._advance_buffer);
+         _advances = _advance_buffer.data();
+         _breaks = std::move(rhs._breaks);
 
          rhs._glyphs = nullptr;
+         rhs._advances = nullptr;
          rhs._clusters = nullptr;
          rhs._scaled_font = nullptr;
       }
@@ -223,95 +406,117 @@ namespace cycfi { namespace elements
          cairo_text_cluster_free(_clusters);
          _clusters = nullptr;
       }
+      _advance_buffer.clear();
+      _advances = nullptr;
+      _breaks = {};
 
       _first = first;
       _last = last;
       build(start);
    }
 
+   void master_glyphs::add_line(int first, int last, bool strip, std::vector<glyphs>& lines)
+   {
+      auto const& b = _breaks;
+      lines.push_back(
+         glyphs{
+            _first + b.byte[first], _first + b.byte[last]
+          , b.glyph[first], b.glyph[last]
+          , first, last
+          , *this
+          , strip
+         }
+      );
+   }
+
    void master_glyphs::break_lines(float width, std::vector<glyphs>& lines)
    {
       CYCFI_ASSERT(_scaled_font, "Precondition failure: _scaled_font must not be null");
 
-      // reurn early if there's nothing to break
+      // An empty text is a single empty line
       if (_first == _last)
+      {
+         lines.push_back(glyphs{ _first, _last });
          return;
+      }
 
       CYCFI_ASSERT(_glyphs, "Precondition failure: _glyphs must not be null");
       CYCFI_ASSERT(_clusters, "Precondition failure: _clusters must not be null");
 
-      char const* first = _first;
-      char const* last = _last;
-      char const* space_pos = _first;
-      int         start_glyph_index = 0;
-      int         start_cluster_index = 0;
-      int         space_glyph_index = 0;
-      int         space_cluster_index = 0;
-      float       start_x = _glyphs->x;
+      // Greedy line breaking. For each line, the furthest cluster that fits
+      // is found by binary search on the clusters' right edges, then the
+      // line is broken at the last space before it, else after the last
+      // punctuation, else (a word that does not fit) right before it.
+      auto const& b = _breaks;
+      auto const  n = _cluster_count;
+      auto const  is_space_ = [&](int c)
+      {
+         return std::binary_search(b.spaces.begin(), b.spaces.end(), c);
+      };
 
-      auto add_line = [&]()
+      auto last_before = [](std::vector<int> const& v, int first, int last)
       {
-         glyphs glyph_{
-            first, space_pos
-          , start_glyph_index, space_glyph_index
-          , start_cluster_index, space_cluster_index
-          , *this
-          , lines.size() > 0 // skip leading spaces if this is not the first line
-         };
-         lines.push_back(std::move(glyph_));
-         first = space_pos;
-         start_glyph_index = space_glyph_index;
-         start_cluster_index = space_cluster_index;
-         start_x = _glyphs[space_glyph_index].x;
+         // The last element of v in (first, last], or first if none
+         auto i = std::upper_bound(v.begin(), v.end(), last);
+         return (i != v.begin() && *(i - 1) > first)? *(i - 1) : first;
       };
 
-      int      glyph_index = 0;
-      unsigned codepoint;
-      unsigned state = 0;
+      auto is_newline_ = [&](int c)
+      {
+         return std::binary_search(b.newlines.begin(), b.newlines.end(), c);
+      };
 
-      cairo_text_cluster_t* cluster = _clusters;
-      for (auto i = _first; i != _last; ++i)
+      bool first_line = true;
+      int  start = 0;
+      while (true)
       {
-         if (!decode_utf8(state, codepoint, uint8_t(*i)))
+         // A newline at start is the one we broke at
+         auto nl = std::upper_bound(b.newlines.begin(), b.newlines.end(), start);
+         int  limit = (nl == b.newlines.end())? n : *nl;
+
+         // Measure from the first cluster that will be drawn. See the
+         // glyphs constructor for the leading spaces and newlines that
+         // are stripped.
+         int x_start = start;
+         if (!first_line)
+            while (x_start < limit && is_space_(x_start) && !is_newline_(x_start))
+               ++x_start;
+         while (x_start < limit && is_newline_(x_start))
+            ++x_start;
+
+         if (x_start == limit)
          {
-            cairo_glyph_t*  glyph = _glyphs + glyph_index;
+            add_line(start, limit, !first_line, lines);
+            if (limit == n)
+               return;
+            start = limit;
+            first_line = false;
+            continue;
+         }
 
-            // Check if we exceeded the line width:
-            cairo_text_extents_t extents;
-            cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
-            if (((glyph->x + extents.x_advance) - start_x) > width)
-            {
-               // Add the line if we did (exceed the line width)
-               add_line();
-            }
+         float x0 = _glyphs[std::min(b.glyph[x_start], _glyph_count - 1)].x;
 
-            // Did we have a space?
-            else if (is_space(codepoint))
-            {
-               // Mark the spaces for later
-               space_glyph_index = glyph_index;
-               space_cluster_index = int(cluster - _clusters);
-               space_pos = i;
-
-               // If we got an explicit new line, add the line right away.
-               if ((space_glyph_index != start_glyph_index) && is_newline(codepoint))
-                  add_line();
-            }
+         // The first cluster that does not fit
+         int fit = int(std::upper_bound(
+            b.right.begin() + x_start, b.right.begin() + limit, x0 + width
+         ) - b.right.begin());
 
-            glyph_index += cluster->num_glyphs;
-            ++cluster;
+         int end = limit;
+         if (fit < limit)
+         {
+            end = last_before(b.spaces, x_start, fit);
+            if (end == x_start)
+               end = last_before(b.soft, x_start, fit);
+            if (end == x_start)
+               end = std::max(fit, x_start + 1);
          }
-      }
 
-      glyphs glyph_{
-         first, last
-       , start_glyph_index, _glyph_count
-       , start_cluster_index, _cluster_count
-       , *this
-       , lines.size() > 1 // skip leading spaces if this is not the first line
-      };
-
-      lines.push_back(std::move(glyph_));
+         add_line(start, end, !first_line, lines);
+         if (end == n)
+            return;
+         start = end;
+         first_line = false;
+      }
    }
 
    void master_glyphs::build(point start)
@@ -331,5 +536,65 @@ namespace cycfi { namespace elements
          _clusters = nullptr;
          throw failed_to_build_master_glyphs{};
       }
+
+      // Compute the advances once, so that measuring, hit testing and line
+      // breaking need not query the scaled font (a locked hash lookup
+      // inside cairo) per glyph, every time. Texts typically use only a
+      // handful of distinct glyphs, so we memoize by glyph index.
+      std::unordered_map<unsigned long, float> advance_of;
+      _advance_buffer.resize(_glyph_count);
+      for (int i = 0; i != _glyph_count; ++i)
+      {
+         auto index = _glyphs[i].index;
+         auto it = advance_of.find(index);
+         if (it == advance_of.end())
+         {
+            cairo_text_extents_t extents;
+            cairo_scaled_font_glyph_extents(_scaled_font, _glyphs + i, 1, &extents);
+            it = advance_of.emplace(index, float(extents.x_advance)).first;
+         }
+         _advance_buffer[i] = it->second;
+      }
+      _advances = _advance_buffer.data();
+      build_breaks();
+   }
+
+   void master_glyphs::build_breaks()
+   {
+      auto& b = _breaks;
+      b = {};
+      b.glyph.reserve(_cluster_count + 1);
+      b.byte.reserve(_cluster_count + 1);
+      b.right.reserve(_cluster_count);
+
+      int   glyph_index = 0;
+      int   byte_index = 0;
+      float right = -std::numeric_limits<float>::infinity();
+      bool  after_punctuation = false;
+      for (int i = 0; i != _cluster_count; ++i)
+      {
+         auto const& cluster = _clusters[i];
+         b.glyph.push_back(glyph_index);
+         b.byte.push_back(byte_index);
+
+         if (cluster.num_glyphs > 0 && glyph_index < _glyph_count)
+            right = std::max(right, float(_glyphs[glyph_index].x + _advances[glyph_index]));
+         b.right.push_back(right);
+
+         char const* utf8 = _first + byte_index;
+         auto cp = codepoint(utf8);
+         if (is_space(cp) || is_newline(cp))
+            b.spaces.push_back(i);
+         if (is_newline(cp))
+            b.newlines.push_back(i);
+         if (after_punctuation)
+            b.soft.push_back(i);
+         after_punctuation = is_punctuation(cp);
+
+         glyph_index += cluster.num_glyphs;
+         byte_index += cluster.num_bytes;
+      }
+      b.glyph.push_back(glyph_index);
+      b.byte.push_back(byte_index);
    }
 }}
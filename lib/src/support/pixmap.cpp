@@ -10,22 +10,525 @@
 #include <elements/support/detail/stb_image.h>
 #include <infra/assert.hpp>
 #include <infra/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
 
 namespace cycfi { namespace elements
 {
-   pixmap::pixmap(point size, float scale)
-    : _surface(cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size.x, size.y))
+   namespace
    {
-      if (!_surface)
+      cairo_format_t cairo_format(pixmap_format format)
+      {
+         switch (format)
+         {
+            case pixmap_format::rgb24: return CAIRO_FORMAT_RGB24;
+            case pixmap_format::a8: return CAIRO_FORMAT_A8;
+            default: return CAIRO_FORMAT_ARGB32;
+         }
+      }
+
+      bool is_valid(cairo_surface_t* surface)
+      {
+         return surface && cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS;
+      }
+
+      inline uint8_t luminance(uint8_t r, uint8_t g, uint8_t b)
+      {
+         return (r * 77 + g * 150 + b * 29) >> 8;
+      }
+
+      inline uint8_t premultiply(uint8_t c, uint8_t a)
+      {
+         return (c * a + 127) / 255;
+      }
+
+      bool all_opaque(cairo_surface_t* surface)
+      {
+         uint8_t* data = cairo_image_surface_get_data(surface);
+         int      w = cairo_image_surface_get_width(surface);
+         int      h = cairo_image_surface_get_height(surface);
+         int      stride = cairo_image_surface_get_stride(surface);
+
+         for (int y = 0; y != h; ++y)
+         {
+            auto row = reinterpret_cast<uint32_t const*>(data + (y * stride));
+            for (int x = 0; x != w; ++x)
+               if ((row[x] >> 24) != 0xff)
+                  return false;
+         }
+         return true;
+      }
+
+      // Convert an ARGB32 or RGB24 image surface to the requested format.
+      // Converting to a8 takes the alpha channel of ARGB32 surfaces and the
+      // luminance of RGB24 surfaces. The source surface is consumed.
+      cairo_surface_t* convert(cairo_surface_t* src, cairo_format_t format)
+      {
+         auto src_format = cairo_image_surface_get_format(src);
+         if (src_format == format)
+            return src;
+
+         cairo_surface_flush(src);
+         int      w = cairo_image_surface_get_width(src);
+         int      h = cairo_image_surface_get_height(src);
+         uint8_t* src_data = cairo_image_surface_get_data(src);
+         int      src_stride = cairo_image_surface_get_stride(src);
+
+         auto     dest_surface = cairo_image_surface_create(format, w, h);
+         uint8_t* dest_data = cairo_image_surface_get_data(dest_surface);
+         int      dest_stride = cairo_image_surface_get_stride(dest_surface);
+
+         for (int y = 0; y != h; ++y)
+         {
+            auto src_row = reinterpret_cast<uint32_t const*>(src_data + (y * src_stride));
+            auto dest_row = dest_data + (y * dest_stride);
+            for (int x = 0; x != w; ++x)
+            {
+               auto pixel = src_row[x];
+               if (format == CAIRO_FORMAT_A8)
+               {
+                  dest_row[x] = (src_format == CAIRO_FORMAT_ARGB32)?
+                     uint8_t(pixel >> 24) :
+                     luminance(pixel >> 16, pixel >> 8, pixel);
+               }
+               else
+               {
+                  // ARGB32 and RGB24 share the same 32-bit layout
+                  reinterpret_cast<uint32_t*>(dest_row)[x] = pixel | 0xff000000;
+               }
+            }
+         }
+
+         cairo_surface_destroy(src);
+         return dest_surface;
+      }
+
+      // Create a surface from the 8-bit per component pixels returned by
+      // stb_image, where components is 1 (grey), 2 (grey, alpha), 3 (rgb) or
+      // 4 (rgba). The pixels are written as native-endian 32-bit words, as
+      // required by cairo's ARGB32 and RGB24 formats.
+      cairo_surface_t* make_surface(
+         uint8_t const* src_data, int w, int h, int components,
+         pixmap_format format
+      )
+      {
+         bool has_alpha = components == 2 || components == 4;
+         if (format == pixmap_format::automatic)
+         {
+            bool opaque = true;
+            if (has_alpha)
+            {
+               for (auto p = src_data + components-1, end = p + (w * h * components);
+                  p != end && opaque; p += components)
+                  opaque = *p == 0xff;
+            }
+            format = opaque? pixmap_format::rgb24 : pixmap_format::argb32;
+         }
+
+         auto     surface = cairo_image_surface_create(cairo_format(format), w, h);
+         uint8_t* dest_data = cairo_image_surface_get_data(surface);
+         size_t   src_stride = w * components;
+         size_t   dest_stride = cairo_image_surface_get_stride(surface);
+
+         for (int y = 0; y != h; ++y)
+         {
+            uint8_t const* src = src_data + (y * src_stride);
+            uint8_t* dest = dest_data + (y * dest_stride);
+            for (int x = 0; x != w; ++x)
+            {
+               uint8_t r, g, b, a = 0xff;
+               if (components < 3)
+               {
+                  r = g = b = src[0];
+                  if (has_alpha)
+                     a = src[1];
+               }
+               else
+               {
+                  r = src[0];
+                  g = src[1];
+                  b = src[2];
+                  if (has_alpha)
+                     a = src[3];
+               }
+               src += components;
+
+               switch (format)
+               {
+                  case pixmap_format::a8:
+                     dest[x] = has_alpha? a : luminance(r, g, b);
+                     break;
+
+                  case pixmap_format::rgb24:
+                     a = 0xff;
+                     [[fallthrough]];
+
+                  default:
+                     reinterpret_cast<uint32_t*>(dest)[x] =
+                        (uint32_t(a) << 24)
+                        | (uint32_t(premultiply(r, a)) << 16)
+                        | (uint32_t(premultiply(g, a)) << 8)
+                        | premultiply(b, a)
+                        ;
+                     break;
+               }
+            }
+         }
+         return surface;
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Decoded image disk cache
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      // Cache file layout: the header, followed by the key, followed by the
+      // pixel rows (exactly as cairo expects them) starting at data_offset.
+      // The files are machine-local, so we do not care about endianness.
+      struct pixmap_cache_header
+      {
+         char           magic[4];
+         std::uint32_t  version;
+         std::uint32_t  format;
+         std::uint32_t  width;
+         std::uint32_t  height;
+         std::uint32_t  stride;
+         std::uint32_t  key_size;
+         std::uint32_t  data_offset;
+      };
+
+      constexpr char pixmap_cache_magic[4] = { 'E', 'P', 'X', 'C' };
+      constexpr std::uint32_t pixmap_cache_version = 1;
+      constexpr std::uint32_t pixmap_cache_align = 64;
+
+      std::pair<fs::path&, std::mutex&>
+      get_pixmap_cache_path()
+      {
+         static fs::path cache_path;
+         static std::mutex cache_path_mutex;
+         return { cache_path, cache_path_mutex };
+      }
+
+      fs::path pixmap_cache_dir()
+      {
+         auto [cache_path, cache_path_mutex] = get_pixmap_cache_path();
+         std::lock_guard<std::mutex> guard(cache_path_mutex);
+         return cache_path;
+      }
+
+      std::atomic<std::uintmax_t>& pixmap_cache_max_bytes()
+      {
+         static std::atomic<std::uintmax_t> max_bytes{ 0 };
+         return max_bytes;
+      }
+
+      // A temporary file name no other process or thread writing the same
+      // cache file will use.
+      fs::path pixmap_cache_temp_file(fs::path const& file)
+      {
+         static std::atomic<unsigned> counter{ 0 };
+#if defined(_WIN32)
+         auto pid = static_cast<unsigned long>(GetCurrentProcessId());
+#else
+         auto pid = static_cast<unsigned long>(getpid());
+#endif
+         auto temp = file;
+         temp += '.' + std::to_string(pid) + '.' + std::to_string(counter++) + ".tmp";
+         return temp;
+      }
+
+      // Remove the cache files written longest ago until the cache is within
+      // max_bytes.
+      // Files still mapped are fine to remove on POSIX. On Windows, removing
+      // them fails and they are left for a later trim.
+      void trim_pixmap_cache(fs::path const& dir, std::uintmax_t max_bytes)
+      {
+         struct entry
+         {
+            fs::path             path;
+            fs::file_time_type   time;
+            std::uintmax_t       size;
+         };
+
+         std::error_code ec;
+         std::vector<entry> entries;
+         std::uintmax_t total = 0;
+         for (auto const& item : fs::directory_iterator(dir, ec))
+         {
+            if (item.path().extension() != ".pxc")
+               continue;
+            std::error_code size_ec, time_ec;
+            auto size = fs::file_size(item.path(), size_ec);
+            auto time = fs::last_write_time(item.path(), time_ec);
+            if (size_ec || time_ec)
+               continue;
+            entries.push_back({ item.path(), time, size });
+            total += size;
+         }
+         if (total <= max_bytes)
+            return;
+
+         std::sort(entries.begin(), entries.end(),
+            [](entry const& a, entry const& b) { return a.time < b.time; });
+         for (auto const& e : entries)
+         {
+            if (total <= max_bytes)
+               break;
+            if (fs::remove(e.path, ec))
+               total -= e.size;
+         }
+      }
+
+      // The cache file name depends only on the image path and the
+      // requested format, so that a modified image replaces its stale
+      // cache entry. The full key, which also has the modification time,
+      // is stored in the file and checked on load.
+      fs::path pixmap_cache_file(
+         fs::path const& dir, fs::path const& full_path, pixmap_format format
+      )
+      {
+         std::error_code ec;
+         auto id = fs::absolute(full_path, ec).string() + '|' + std::to_string(int(format));
+         char name[32];
+         std::snprintf(
+            name, sizeof(name), "%016llx.pxc"
+          , static_cast<unsigned long long>(std::hash<std::string>{}(id))
+         );
+         return dir / name;
+      }
+
+      std::string pixmap_cache_key(fs::path const& full_path, pixmap_format format)
+      {
+         std::error_code ec;
+         auto mtime = fs::last_write_time(full_path, ec);
+         if (ec)
+            return {};
+         return fs::absolute(full_path, ec).string()
+            + '|' + std::to_string(mtime.time_since_epoch().count())
+            + '|' + std::to_string(int(format))
+            ;
+      }
+
+      struct mapped_file
+      {
+         std::uint8_t*  data = nullptr;
+         std::size_t    size = 0;
+      };
+
+      // Map the file copy-on-write: pixmaps are writable (see pixmap_context)
+      // but changes must never make it back to the cache file.
+      mapped_file* map_file(fs::path const& path)
+      {
+#if defined(_WIN32)
+         HANDLE file = CreateFileW(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr
+          , OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+         );
+         if (file == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+         LARGE_INTEGER size;
+         HANDLE mapping = nullptr;
+         if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+         CloseHandle(file);
+         if (!mapping)
+            return nullptr;
+
+         // The view keeps the mapping alive
+         void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+         CloseHandle(mapping);
+         if (!data)
+            return nullptr;
+         return new mapped_file{ static_cast<std::uint8_t*>(data), std::size_t(size.QuadPart) };
+#else
+         int fd = ::open(path.c_str(), O_RDONLY);
+         if (fd < 0)
+            return nullptr;
+
+         struct stat st;
+         void* data = MAP_FAILED;
+         if (::fstat(fd, &st) == 0 && st.st_size > 0)
+            data = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+         ::close(fd);
+         if (data == MAP_FAILED)
+            return nullptr;
+         return new mapped_file{ static_cast<std::uint8_t*>(data), std::size_t(st.st_size) };
+#endif
+      }
+
+      void unmap_file(void* p)
+      {
+         auto mf = static_cast<mapped_file*>(p);
+#if defined(_WIN32)
+         UnmapViewOfFile(mf->data);
+#else
+         ::munmap(mf->data, mf->size);
+#endif
+         delete mf;
+      }
+
+      cairo_user_data_key_t mapped_file_key;
+
+      cairo_surface_t* load_cached_surface(fs::path const& file, std::string const& key)
+      {
+         auto mf = map_file(file);
+         if (!mf)
+            return nullptr;
+
+         pixmap_cache_header header;
+         bool valid = mf->size >= sizeof(header);
+         if (valid)
+         {
+            std::memcpy(&header, mf->data, sizeof(header));
+            auto format = cairo_format_t(header.format);
+            valid =
+               std::memcmp(header.magic, pixmap_cache_magic, sizeof(header.magic)) == 0
+               && header.version == pixmap_cache_version
+               && (format == CAIRO_FORMAT_ARGB32
+                  || format == CAIRO_FORMAT_RGB24
+                  || format == CAIRO_FORMAT_A8)
+               && int(header.stride) == cairo_format_stride_for_width(format, header.width)
+               && header.key_size == key.size()
+               && sizeof(header) + header.key_size <= header.data_offset
+               && header.data_offset % pixmap_cache_align == 0
+               && header.data_offset + std::size_t(header.stride) * header.height <= mf->size
+               && std::memcmp(mf->data + sizeof(header), key.data(), key.size()) == 0
+               ;
+         }
+
+         if (!valid)
+         {
+            unmap_file(mf);
+            return nullptr;
+         }
+
+         auto surface = cairo_image_surface_create_for_data(
+            mf->data + header.data_offset, cairo_format_t(header.format)
+          , header.width, header.height, header.stride
+         );
+
+         if (!is_valid(surface)
+            || cairo_surface_set_user_data(surface, &mapped_file_key, mf, unmap_file)
+               != CAIRO_STATUS_SUCCESS)
+         {
+            cairo_surface_destroy(surface);
+            unmap_file(mf);
+            return nullptr;
+         }
+         return surface;
+      }
+
+      // Write to a temporary file first, then rename. This way, a partially
+      // written file is never seen, and live mappings of the previous cache
+      // file (by this or another process) are left untouched.
+      void store_cached_surface(
+         fs::path const& file, std::string const& key, cairo_surface_t* surface
+      )
+      {
+         cairo_surface_flush(surface);
+
+         pixmap_cache_header header;
+         std::memcpy(header.magic, pixmap_cache_magic, sizeof(header.magic));
+         header.version = pixmap_cache_version;
+         header.format = cairo_image_surface_get_format(surface);
+         header.width = cairo_image_surface_get_width(surface);
+         header.height = cairo_image_surface_get_height(surface);
+         header.stride = cairo_image_surface_get_stride(surface);
+         header.key_size = key.size();
+         header.data_offset =
+            ((sizeof(header) + key.size() + pixmap_cache_align - 1)
+               / pixmap_cache_align) * pixmap_cache_align;
+
+         std::error_code ec;
+         fs::create_directories(file.parent_path(), ec);
+
+         auto temp = pixmap_cache_temp_file(file);
+         {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out)
+               return;
+            out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            out.write(key.data(), key.size());
+
+            char const padding[pixmap_cache_align] = {};
+            out.write(padding, header.data_offset - (sizeof(header) + key.size()));
+            out.write(
+               reinterpret_cast<char const*>(cairo_image_surface_get_data(surface))
+             , std::streamsize(header.stride) * header.height
+            );
+            if (!out)
+            {
+               out.close();
+               fs::remove(temp, ec);
+               return;
+            }
+         }
+
+         fs::rename(temp, file, ec);
+         if (ec)
+         {
+            fs::remove(temp, ec);
+            return;
+         }
+
+         if (auto max_bytes = pixmap_cache_max_bytes().load())
+            trim_pixmap_cache(file.parent_path(), max_bytes);
+      }
+   }
+
+   void enable_pixmap_cache(fs::path const& path, std::uintmax_t max_bytes)
+   {
+      auto dir = path.empty()?
+         app_data_path() / "elements" / "pixmap_cache" : path;
+      pixmap_cache_max_bytes() = max_bytes;
+
+      auto [cache_path, cache_path_mutex] = get_pixmap_cache_path();
+      std::lock_guard<std::mutex> guard(cache_path_mutex);
+      cache_path = dir;
+   }
+
+   void disable_pixmap_cache()
+   {
+      auto [cache_path, cache_path_mutex] = get_pixmap_cache_path();
+      std::lock_guard<std::mutex> guard(cache_path_mutex);
+      cache_path.clear();
+   }
+
+   pixmap::pixmap(point size, float scale, pixmap_format format)
+    : _surface(cairo_image_surface_create(cairo_format(format), size.x, size.y))
+   {
+      if (!is_valid(_surface))
+      {
+         if (_surface)
+            cairo_surface_destroy(_surface);
          throw failed_to_load_pixmap{ "Failed to create pixmap." };
+      }
 
       // Set scale and flag the surface as dirty
       cairo_surface_set_device_scale(_surface, 1/scale, 1/scale);
       cairo_surface_mark_dirty(_surface);
    }
 
-   pixmap::pixmap(char const* filename, float scale)
+   pixmap::pixmap(char const* filename, float scale, pixmap_format format)
     : _surface(nullptr)
    {
       auto  path = std::string(filename);
@@ -37,50 +540,63 @@ namespace cycfi { namespace elements
       if (full_path.empty())
          throw failed_to_load_pixmap{ "File does not exist." };
 
-      auto  ext = path.substr(pos);
-      if (ext == ".png" || ext == ".PNG")
+      // Try the disk cache first
+      auto        cache_dir = pixmap_cache_dir();
+      fs::path    cache_file;
+      std::string cache_key;
+      if (!cache_dir.empty())
       {
-         // For PNGs, use Cairo's native PNG loader
-         _surface = cairo_image_surface_create_from_png(full_path.string().c_str());
+         cache_file = pixmap_cache_file(cache_dir, full_path, format);
+         cache_key = pixmap_cache_key(full_path, format);
+         if (!cache_key.empty())
+            _surface = load_cached_surface(cache_file, cache_key);
       }
-      else
-      {
-         // For everything else, use stb_image
-         int w, h, components;
-         uint8_t* src_data = stbi_load(full_path.string().c_str(), &w, &h, &components, 4);
 
-         if (src_data)
+      if (!_surface)
+      {
+         auto  ext = path.substr(pos);
+         if (ext == ".png" || ext == ".PNG")
          {
-            _surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
-
-            uint8_t* dest_data = cairo_image_surface_get_data(_surface);
-            size_t   src_stride = w * 4;
-            size_t   dest_stride = cairo_image_surface_get_stride(_surface);
-
-            for (int y = 0; y != h; ++y)
+            // For PNGs, use Cairo's native PNG loader. Cairo already gives us
+            // RGB24 for PNGs without an alpha channel.
+            _surface = cairo_image_surface_create_from_png(full_path.string().c_str());
+            if (is_valid(_surface))
             {
-               uint8_t* src = src_data + (y * src_stride);
-               uint8_t* dest = dest_data + (y * dest_stride);
-               for (int x = 0; x != w; ++x)
+               if (format == pixmap_format::automatic)
                {
-                  // $$$ TODO: Deal with endian issues $$$
-
-                  dest[0] = src[2];    // blue
-                  dest[1] = src[1];    // green
-                  dest[2] = src[0];    // red
-                  dest[3] = src[3];    // alpha
-
-                  src += 4;
-                  dest += 4;
+                  if (cairo_image_surface_get_format(_surface) == CAIRO_FORMAT_ARGB32
+                     && all_opaque(_surface))
+                     _surface = convert(_surface, CAIRO_FORMAT_RGB24);
+               }
+               else
+               {
+                  _surface = convert(_surface, cairo_format(format));
                }
             }
+         }
+         else
+         {
+            // For everything else, use stb_image
+            int w, h, components;
+            uint8_t* src_data = stbi_load(full_path.string().c_str(), &w, &h, &components, 0);
 
-            stbi_image_free(src_data);
+            if (src_data)
+            {
+               _surface = make_surface(src_data, w, h, components, format);
+               stbi_image_free(src_data);
+            }
          }
+
+         if (!cache_key.empty() && is_valid(_surface))
+            store_cached_surface(cache_file, cache_key, _surface);
       }
 
-      if (!_surface)
+      if (!is_valid(_surface))
+      {
+         if (_surface)
+            cairo_surface_destroy(_surface);
          throw failed_to_load_pixmap{ "Failed to load pixmap." };
+      }
 
       // Set scale and flag the surface as dirty
       cairo_surface_set_device_scale(_surface, 1/scale, 1/scale);
@@ -114,4 +630,24 @@ namespace cycfi { namespace elements
    {
       cairo_surface_set_device_scale(_surface, 1/val, 1/val);
    }
+
+   pixmap_format pixmap::format() const
+   {
+      switch (cairo_image_surface_get_format(_surface))
+      {
+         case CAIRO_FORMAT_RGB24: return pixmap_format::rgb24;
+         case CAIRO_FORMAT_A8: return pixmap_format::a8;
+         default: return pixmap_format::argb32;
+      }
+   }
+
+   bool pixmap::is_opaque() const
+   {
+      return cairo_image_surface_get_format(_surface) == CAIRO_FORMAT_RGB24;
+   }
+
+   bool pixmap::is_mask() const
+   {
+      return cairo_image_surface_get_format(_surface) == CAIRO_FORMAT_A8;
+   }
 }}
@@ -0,0 +1,364 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/support/text_buffer.hpp>
+#include <elements/support/text_utils.hpp>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The tree is a persistent AVL tree, keyed by line index. Nodes are never
+   // modified once built; all operations below are expressed in terms of
+   // join and split, copying only the nodes along the path.
+   ////////////////////////////////////////////////////////////////////////////
+   struct text_buffer_detail
+   {
+      using node = text_buffer::node;
+      using node_ptr = text_buffer::node_ptr;
+      using line_ptr = text_buffer::line_ptr;
+
+      static int height(node_ptr const& n)
+      {
+         return n ? n->height : 0;
+      }
+
+      static std::size_t lines(node_ptr const& n)
+      {
+         return n ? n->lines : 0;
+      }
+
+      static std::size_t bytes(node_ptr const& n)
+      {
+         return n ? n->bytes : 0;
+      }
+
+      static node_ptr make(node_ptr l, line_ptr line, node_ptr r)
+      {
+         auto h = std::max(height(l), height(r)) + 1;
+         auto nl = lines(l) + lines(r) + 1;
+         auto nb = bytes(l) + bytes(r) + line->size();
+         return std::make_shared<node const>(
+            node{ std::move(l), std::move(r), std::move(line), h, nl, nb });
+      }
+
+      static node_ptr rotate_left(node_ptr const& n)
+      {
+         auto const& r = n->right;
+         return make(make(n->left, n->line, r->left), r->line, r->right);
+      }
+
+      static node_ptr rotate_right(node_ptr const& n)
+      {
+         auto const& l = n->left;
+         return make(l->left, l->line, make(l->right, n->line, n->right));
+      }
+
+      // Precondition: height(l) > height(r) + 1
+      static node_ptr join_right(node_ptr const& l, line_ptr line, node_ptr const& r)
+      {
+         if (height(l->right) <= height(r) + 1)
+         {
+            auto t = make(l->right, std::move(line), r);
+            if (height(t) <= height(l->left) + 1)
+               return make(l->left, l->line, t);
+            return rotate_left(make(l->left, l->line, rotate_right(t)));
+         }
+         auto t = join_right(l->right, std::move(line), r);
+         auto t2 = make(l->left, l->line, t);
+         if (height(t) <= height(l->left) + 1)
+            return t2;
+         return rotate_left(t2);
+      }
+
+      // Precondition: height(r) > height(l) + 1
+      static node_ptr join_left(node_ptr const& l, line_ptr line, node_ptr const& r)
+      {
+         if (height(r->left) <= height(l) + 1)
+         {
+            auto t = make(l, std::move(line), r->left);
+            if (height(t) <= height(r->right) + 1)
+               return make(t, r->line, r->right);
+            return rotate_right(make(rotate_left(t), r->line, r->right));
+         }
+         auto t = join_left(l, std::move(line), r->left);
+         auto t2 = make(t, r->line, r->right);
+         if (height(t) <= height(r->right) + 1)
+            return t2;
+         return rotate_right(t2);
+      }
+
+      static node_ptr join(node_ptr const& l, line_ptr line, node_ptr const& r)
+      {
+         if (height(l) > height(r) + 1)
+            return join_right(l, std::move(line), r);
+         if (height(r) > height(l) + 1)
+            return join_left(l, std::move(line), r);
+         return make(l, std::move(line), r);
+      }
+
+      static node_ptr split_last(node_ptr const& n, line_ptr& last)
+      {
+         if (!n->right)
+         {
+            last = n->line;
+            return n->left;
+         }
+         return join(n->left, n->line, split_last(n->right, last));
+      }
+
+      static node_ptr join(node_ptr const& l, node_ptr const& r)
+      {
+         if (!l)
+            return r;
+         if (!r)
+            return l;
+         line_ptr last;
+         auto l2 = split_last(l, last);
+         return join(l2, std::move(last), r);
+      }
+
+      // Split n into the first i lines and the rest
+      static std::pair<node_ptr, node_ptr> split(node_ptr const& n, std::size_t i)
+      {
+         if (!n)
+            return {};
+         auto nl = lines(n->left);
+         if (i <= nl)
+         {
+            auto s = split(n->left, i);
+            return { s.first, join(s.second, n->line, n->right) };
+         }
+         auto s = split(n->right, i - nl - 1);
+         return { join(n->left, n->line, s.first), s.second };
+      }
+
+      // Replace the i-th line, copying only the path to it
+      static node_ptr set_line(node_ptr const& n, std::size_t i, line_ptr line)
+      {
+         auto nl = lines(n->left);
+         if (i < nl)
+            return make(set_line(n->left, i, std::move(line)), n->line, n->right);
+         if (i > nl)
+            return make(n->left, n->line, set_line(n->right, i - nl - 1, std::move(line)));
+         return make(n->left, std::move(line), n->right);
+      }
+
+      static node_ptr build(std::vector<line_ptr> const& lines_, std::size_t first, std::size_t last)
+      {
+         if (first == last)
+            return {};
+         auto mid = first + (last - first) / 2;
+         return make(build(lines_, first, mid), lines_[mid], build(lines_, mid + 1, last));
+      }
+
+      // Find the line that contains pos. A position at the end of a line
+      // (i.e. at its newline) belongs to that line.
+      static node const* find(
+         node_ptr const& root, std::size_t pos
+       , std::size_t& index, std::size_t& line_start
+      )
+      {
+         index = 0;
+         line_start = 0;
+         node const* n = root.get();
+         while (n)
+         {
+            // Each line in the left subtree is followed by a newline
+            auto left_span = bytes(n->left) + lines(n->left);
+            if (pos < left_span)
+            {
+               n = n->left.get();
+               continue;
+            }
+            pos -= left_span;
+            index += lines(n->left);
+            line_start += left_span;
+            if (pos <= n->line->size() || !n->right)
+               return n;
+            pos -= n->line->size() + 1;
+            index += 1;
+            line_start += n->line->size() + 1;
+            n = n->right.get();
+         }
+         return nullptr;
+      }
+
+      static void split_lines(string_view text, std::vector<line_ptr>& lines_)
+      {
+         auto first = text.data();
+         auto last = first + text.size();
+         while (true)
+         {
+            auto nl = std::find(first, last, '\n');
+            lines_.push_back(std::make_shared<std::string const>(first, nl));
+            if (nl == last)
+               break;
+            first = nl + 1;
+         }
+      }
+   };
+
+   using detail_ = text_buffer_detail;
+
+   text_buffer::text_buffer()
+    : text_buffer(string_view{ "" })
+   {}
+
+   text_buffer::text_buffer(string_view text)
+   {
+      std::vector<line_ptr> lines;
+      detail_::split_lines(text, lines);
+      _root = detail_::build(lines, 0, lines.size());
+   }
+
+   std::size_t text_buffer::size() const
+   {
+      // n lines are separated by n-1 newlines
+      return _root->bytes + _root->lines - 1;
+   }
+
+   std::size_t text_buffer::num_lines() const
+   {
+      return _root->lines;
+   }
+
+   std::string text_buffer::str() const
+   {
+      std::string result;
+      result.reserve(size());
+      bool first = true;
+      for_each_line(
+         [&](line_ptr const& line)
+         {
+            if (!first)
+               result += '\n';
+            result += *line;
+            first = false;
+            return true;
+         }
+      );
+      return result;
+   }
+
+   std::string text_buffer::substr(std::size_t pos, std::size_t n) const
+   {
+      auto size_ = size();
+      pos = std::min(pos, size_);
+      n = std::min(n, size_ - pos);
+
+      std::string result;
+      result.reserve(n);
+
+      std::size_t index, line_start;
+      detail_::find(_root, pos, index, line_start);
+      auto offset = pos - line_start;
+      for_each_line(
+         [&](line_ptr const& line)
+         {
+            if (offset < line->size())
+               result.append(*line, offset, std::min(line->size() - offset, n - result.size()));
+            offset = 0;
+            if (result.size() < n)
+               result += '\n';
+            return result.size() < n;
+         }
+       , index
+      );
+      return result;
+   }
+
+   text_buffer::line_ptr text_buffer::line(std::size_t i) const
+   {
+      line_ptr result;
+      for_each_line(
+         [&](line_ptr const& line)
+         {
+            result = line;
+            return false;
+         }
+       , i
+      );
+      return result;
+   }
+
+   string_view text_buffer::line_at(std::size_t pos, std::size_t& line_start) const
+   {
+      std::size_t index;
+      auto n = detail_::find(_root, std::min(pos, size()), index, line_start);
+      return { n->line->data(), n->line->size() };
+   }
+
+   std::size_t text_buffer::next(std::size_t pos) const
+   {
+      if (pos >= size())
+         return size();
+
+      std::size_t line_start;
+      auto line = line_at(pos, line_start);
+      auto offset = pos - line_start;
+      if (offset == line.size())
+         return pos + 1;   // Skip the newline
+
+      auto last = line.data() + line.size();
+      return line_start + (next_utf8(last, line.data() + offset) - line.data());
+   }
+
+   std::size_t text_buffer::prev(std::size_t pos) const
+   {
+      if (pos == 0)
+         return 0;
+
+      std::size_t line_start;
+      auto line = line_at(std::min(pos, size()), line_start);
+      auto offset = pos - line_start;
+      if (offset == 0)
+         return pos - 1;   // Skip the newline
+
+      return line_start + (prev_utf8(line.data(), line.data() + offset) - line.data());
+   }
+
+   void text_buffer::replace(std::size_t pos, std::size_t n, string_view text)
+   {
+      auto size_ = size();
+      pos = std::min(pos, size_);
+      n = std::min(n, size_ - pos);
+
+      // Find the first and last lines affected by the edit
+      std::size_t first, first_start, last, last_start;
+      auto first_node = detail_::find(_root, pos, first, first_start);
+      auto last_node = detail_::find(_root, pos + n, last, last_start);
+
+      // Build the new lines: the head of the first line, the new text, and
+      // the tail of the last line.
+      auto const& head = *first_node->line;
+      auto const& tail = *last_node->line;
+      std::string merged;
+      merged.reserve((pos - first_start) + text.size() + (tail.size() - (pos + n - last_start)));
+      merged.append(head, 0, pos - first_start);
+      merged.append(text.data(), text.size());
+      merged.append(tail, pos + n - last_start, std::string::npos);
+
+      std::vector<line_ptr> lines;
+      detail_::split_lines(merged, lines);
+
+      // The common case: an edit within a single line
+      if (first == last && lines.size() == 1)
+      {
+         _root = detail_::set_line(_root, first, std::move(lines[0]));
+         return;
+      }
+
+      // Otherwise, splice them in place of the old lines
+      auto s1 = detail_::split(_root, first);
+      auto s2 = detail_::split(s1.second, last - first + 1);
+      _root = detail_::join(
+         detail_::join(s1.first, detail_::build(lines, 0, lines.size()))
+       , s2.second
+      );
+   }
+}}
@@ -5,6 +5,14 @@
 =============================================================================*/
 #include <elements/support/text_utils.hpp>
 #include <elements/support/theme.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define ELEMENTS_UTF8_SSE2
+#endif
 
 namespace cycfi { namespace elements
 {
@@ -74,4 +82,156 @@ namespace cycfi { namespace elements
       detail::codepoint_to_utf8(codepoint, &result[0]);
       return { result };
    }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Bulk UTF8 scanning
+   ////////////////////////////////////////////////////////////////////////////
+   namespace
+   {
+      constexpr std::uint64_t high_bits = 0x8080808080808080ull;
+
+      std::uint64_t load_word(char const* p)
+      {
+         std::uint64_t w;
+         std::memcpy(&w, p, sizeof(w));
+         return w;
+      }
+
+      int popcount(std::uint64_t x)
+      {
+         int n = 0;
+         for (; x; x &= x - 1)
+            ++n;
+         return n;
+      }
+
+      // Number of continuation bytes (10xxxxxx) in [first, last)
+      std::size_t count_continuations(char const* first, char const* last)
+      {
+         std::size_t n = 0;
+#if defined(ELEMENTS_UTF8_SSE2)
+         // Continuation bytes are the ones less than -64 as signed chars
+         auto const limit = _mm_set1_epi8(-64);
+         for (; last - first >= 16; first += 16)
+         {
+            auto block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+            auto mask = _mm_movemask_epi8(_mm_cmplt_epi8(block, limit));
+            n += popcount(unsigned(mask));
+         }
+#endif
+         for (; last - first >= 8; first += 8)
+         {
+            auto w = load_word(first);
+            n += popcount(w & ~(w << 1) & high_bits);
+         }
+         for (; first != last; ++first)
+            n += (uint8_t(*first) & 0xC0) == 0x80;
+         return n;
+      }
+   }
+
+   char const* skip_ascii(char const* first, char const* last)
+   {
+#if defined(ELEMENTS_UTF8_SSE2)
+      for (; last - first >= 16; first += 16)
+      {
+         auto block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+         if (_mm_movemask_epi8(block))
+            break;
+      }
+#endif
+      for (; last - first >= 8; first += 8)
+      {
+         if (load_word(first) & high_bits)
+            break;
+      }
+      while (first != last && !(uint8_t(*first) & 0x80))
+         ++first;
+      return first;
+   }
+
+   bool validate_utf8(char const* first, char const* last)
+   {
+      unsigned state = utf8_accept;
+      unsigned cp;
+      while (first != last)
+      {
+         if (state == utf8_accept)
+         {
+            first = skip_ascii(first, last);
+            if (first == last)
+               break;
+         }
+         if (decode_utf8(state, cp, uint8_t(*first++)) == utf8_reject)
+            return false;
+      }
+      return state == utf8_accept;
+   }
+
+   std::size_t count_codepoints(char const* first, char const* last)
+   {
+      return (last - first) - count_continuations(first, last);
+   }
+
+   char const* utf8_offset(char const* first, char const* last, std::size_t index)
+   {
+      while (first != last)
+      {
+         // Skip whole blocks of ASCII
+         auto ascii_end = skip_ascii(first, first + std::min<std::size_t>(index, last - first));
+         index -= ascii_end - first;
+         first = ascii_end;
+         if (index == 0 || first == last)
+            break;
+
+         first = next_utf8(last, first);
+         --index;
+      }
+
+      // Do not stop in the middle of a codepoint
+      while (first != last && (uint8_t(*first) & 0xC0) == 0x80)
+         ++first;
+      return first;
+   }
+
+   std::string repair_utf8(char const* first, char const* last)
+   {
+      std::string result;
+      result.reserve(last - first);
+      while (first != last)
+      {
+         auto ascii_end = skip_ascii(first, last);
+         result.append(first, ascii_end);
+         first = ascii_end;
+         if (first == last)
+            break;
+
+         // Decode one codepoint. Replace the bytes of an invalid sequence
+         // (up to where the decoder rejected it) with U+FFFD.
+         unsigned state = utf8_accept;
+         unsigned cp;
+         auto start = first;
+         while (first != last)
+         {
+            state = decode_utf8(state, cp, uint8_t(*first));
+            if (state == utf8_reject)
+               break;
+            ++first;
+            if (state == utf8_accept)
+               break;
+         }
+
+         if (state == utf8_accept)
+         {
+            result.append(start, first);
+         }
+         else
+         {
+            result += "\xEF\xBF\xBD";
+            if (first == start)
+               ++first;   // The lead byte itself was invalid
+         }
+      }
+      return result;
+   }
 }}
@@ -100,4 +100,41 @@ namespace cycfi { namespace elements
    {
       global_theme::_theme() = thm;
    }
+
+   namespace
+   {
+      std::string printable_ascii()
+      {
+         std::string chars;
+         for (char ch = ' '; ch < 127; ++ch)
+            chars += ch;
+         return chars;
+      }
+
+      std::string icon_chars()
+      {
+         std::string chars;
+         for (unsigned cp = icons::left; cp <= icons::question; ++cp)
+            chars += codepoint_to_utf8(cp);
+         for (unsigned cp : { icons::sliders, icons::lightbulb, icons::hand, icons::menu })
+            chars += codepoint_to_utf8(cp);
+         return chars;
+      }
+   }
+
+   void warm_up_glyphs(theme const& thm, float scale)
+   {
+      static std::string const text = printable_ascii();
+      static std::string const icon_text = icon_chars();
+
+      warm_up_glyphs(
+         {
+            { thm.label_font, thm.label_font_size, text }
+          , { thm.heading_font, thm.heading_font_size, text }
+          , { thm.text_box_font, thm.text_box_font_size, text }
+          , { thm.icon_font, thm.icon_font_size, icon_text }
+         }
+       , scale
+      );
+   }
 }}
@@ -35,6 +35,11 @@
 
    view::~view()
    {
+      {
+         // Posts through our handles are dropped from here on
+         std::lock_guard<std::mutex> lock(_link->mutex);
+         _link->view_ = nullptr;
+      }
       _io.stop();
    }
 
@@ -295,22 +300,22 @@
 
    void view::add_undo(undo_redo_task f)
    {
-      _undo_stack.push(f);
-      if (has_redo())
-      {
-         // clear the redo stack
-         undo_stack_type empty{};
-         _redo_stack.swap(empty);
-      }
+      _undo_bytes += f.size;
+      _undo_stack.push_back(std::move(f));
+
+      // clear the redo stack
+      _redo_stack.clear();
+      trim_undo();
    }
 
    bool view::undo()
    {
       if (has_undo())
       {
-         auto t = _undo_stack.top();
-         _undo_stack.pop();
-         _redo_stack.push(t);
+         auto t = std::move(_undo_stack.back());
+         _undo_stack.pop_back();
+         _undo_bytes -= t.size;
+         _redo_stack.push_back(t);
          t.undo();  // execute undo function
          return true;
       }
@@ -321,15 +326,37 @@
    {
       if (has_redo())
       {
-         auto t = _redo_stack.top();
-         _undo_stack.push(t);
-         _redo_stack.pop();
+         auto t = std::move(_redo_stack.back());
+         _redo_stack.pop_back();
+         _undo_bytes += t.size;
+         _undo_stack.push_back(t);
          t.redo();  // execute redo function
+         trim_undo();
          return true;
       }
       return false;
    }
 
+   void view::undo_limits(std::size_t max_steps, std::size_t max_bytes)
+   {
+      _max_undo_steps = max_steps;
+      _max_undo_bytes = max_bytes;
+      trim_undo();
+   }
+
+   void view::trim_undo()
+   {
+      // Drop the oldest undo tasks until we are within budget. The redo
+      // stack holds tasks that were undone, which are never more than
+      // what the undo stack held.
+      while (!_undo_stack.empty() &&
+         (_undo_stack.size() > _max_undo_steps || _undo_bytes > _max_undo_bytes))
+      {
+         _undo_bytes -= _undo_stack.front().size;
+         _undo_stack.pop_front();
+      }
+   }
+
    void view::begin_focus()
    {
       if (_content.empty() || !_is_focus)